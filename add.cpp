@@ -10,17 +10,36 @@ see LICENSE file.
 
 #include <iostream>
 #include <string_view>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <filesystem>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring> // for strerror
+#include <numeric> // for accumulate
+
+#include <sys/stat.h>
 
 #include "libtorrent/create_torrent.hpp"
 #include "libtorrent/entry.hpp"
 #include "libtorrent/bdecode.hpp"
 
 #include "common.hpp"
+#include "hash_files.hpp"
+#include "stats.hpp"
+#include "splice.hpp"
+#include "sidecar.hpp"
 
 using namespace std::string_view_literals;
 
 namespace {
 
+int const default_num_threads
+	= std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
 void print_usage()
 {
 	std::cout << R"(USAGE: torrent-add torrent-file [OPTIONS] files...
@@ -29,17 +48,208 @@ OPTIONS:
                           If not specified "a.torrent" is used.
 -m, --mtime               Include modification time of files
 -l, --dont-follow-links   Instead of following symlinks, store them as symlinks
+--threads <n>             Use <n> threads to hash files. Defaults to )"
+	<< default_num_threads << R"(.
+--hdd-depth <n>           The number of concurrent reads per spinning disk.
+                          Defaults to 1
+--ssd-depth <n>           The number of concurrent reads per device that isn't
+                          a spinning disk. Defaults to 4
+--stats[=json]            Print where time was spent (parsing, reading,
+                          hashing, writing etc.) to stderr on exit
+--sidecar                 Also write the file roots and piece layers to
+                          <out>.sidecar (see torrent-new --sidecar)
 -h, --help                Show this message
--q                        Quiet, do not print log messages
+-q                        Quiet, do not print log messages or progress
 
 Reads torrent-file and adds the files, specified by "files...". The resulting
 torrent is written to the output file specified by -o (or a.torrent by
 default).
 
+If a directory is specified, all files in it are added, preserving their
+relative paths. i.e. the directory will appear in the root of the torrent. If
+a directory by the same name already exists in the torrent, the new files are
+added to it. Adding a file that already exists in the torrent is an error.
+
+All files are hashed concurrently, large files are also split up to be
+hashed by multiple threads.
+
 Only BitTorrent v2 torrent files are supported.
 )";
 }
 
+// a file found when walking a directory
+struct walked_file
+{
+	// the path relative to the parent of the directory being walked, i.e.
+	// the first element is the name of the directory itself
+	std::string path;
+	std::int64_t size;
+	lt::file_flags_t flags;
+	std::time_t mtime;
+	std::string symlink;
+};
+
+// lists all files under the directory "root", recursively. Directories are
+// listed concurrently by "num_threads" threads. The returned list is sorted by
+// path, to not depend on the order the threads happened to find the files in
+std::vector<walked_file> walk_directory(std::string root
+	, int const num_threads, lt::create_flags_t const flags)
+{
+	namespace fs = std::filesystem;
+
+	while (root.size() > 1 && (root.back() == '/' || root.back() == '\\'))
+		root.pop_back();
+
+	std::string const base = branch_path(root);
+	std::vector<walked_file> ret;
+
+	std::mutex mutex;
+	std::condition_variable cond;
+	// directories (relative to base) that have not been listed yet
+	std::vector<std::string> pending{fs::path(root).filename().generic_string()};
+	int busy = 0;
+	std::exception_ptr error;
+
+	auto worker = [&] {
+		std::unique_lock<std::mutex> l(mutex);
+		for (;;) {
+			cond.wait(l, [&] { return !pending.empty() || busy == 0 || error; });
+			if (pending.empty() || error) break;
+
+			std::string const dir = std::move(pending.back());
+			pending.pop_back();
+			++busy;
+			l.unlock();
+
+			std::vector<walked_file> files;
+			std::vector<std::string> dirs;
+			try {
+				for (auto const& de : fs::directory_iterator(base + dir)) {
+					std::string const name = de.path().filename().generic_string();
+					std::string const path = dir + '/' + name;
+					std::string const full_path = base + path;
+
+					walked_file f{path, 0, {}, 0, {}};
+					stats::scoped_timer stat_timer(stats::timer::stat);
+#ifdef TORRENT_WINDOWS
+					struct _stat64 st;
+					if (::_stat64(full_path.c_str(), &st) != 0)
+#else
+					struct stat st;
+					int const ret = (flags & lt::create_torrent::symlinks)
+						? ::lstat(full_path.c_str(), &st)
+						: ::stat(full_path.c_str(), &st);
+					if (ret != 0)
+#endif
+						throw std::runtime_error("failed to stat \"" + full_path + "\": " + strerror(errno));
+
+#ifndef TORRENT_WINDOWS
+					if (S_ISLNK(st.st_mode)) {
+						f.flags |= lt::file_storage::flag_symlink;
+						f.symlink = fs::read_symlink(full_path).generic_string();
+						files.push_back(std::move(f));
+						continue;
+					}
+#endif
+#ifdef TORRENT_WINDOWS
+					bool const is_dir = (st.st_mode & _S_IFDIR) != 0;
+#else
+					bool const is_dir = S_ISDIR(st.st_mode);
+#endif
+					if (is_dir) {
+						dirs.push_back(path);
+						continue;
+					}
+
+#ifndef TORRENT_WINDOWS
+					if (st.st_mode & S_IXUSR)
+						f.flags |= lt::file_storage::flag_executable;
+#endif
+					f.size = st.st_size;
+					f.mtime = st.st_mtime;
+					files.push_back(std::move(f));
+				}
+			}
+			catch (...) {
+				l.lock();
+				if (!error) error = std::current_exception();
+				--busy;
+				cond.notify_all();
+				break;
+			}
+
+			l.lock();
+			std::move(files.begin(), files.end(), std::back_inserter(ret));
+			std::move(dirs.begin(), dirs.end(), std::back_inserter(pending));
+			--busy;
+			cond.notify_all();
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (int i = 1; i < num_threads; ++i) pool.emplace_back(worker);
+	worker();
+	for (auto& t : pool) t.join();
+
+	if (error) std::rethrow_exception(error);
+
+	std::sort(ret.begin(), ret.end()
+		, [](walked_file const& lhs, walked_file const& rhs) { return lhs.path < rhs.path; });
+	return ret;
+}
+
+// inserts all entries of "src" into the file tree "dst", recursing into
+// directories that exist in both
+void merge_file_tree(lt::entry::dictionary_type& dst
+	, lt::entry::dictionary_type& src, std::string const& path)
+{
+	for (auto& [name, e] : src) {
+		auto const it = dst.find(name);
+		if (it == dst.end()) {
+			dst.emplace(name, std::move(e));
+			continue;
+		}
+
+		// a file is a dictionary with a single, empty, key
+		if (e.dict().count("") || it->second.dict().count(""))
+			throw std::runtime_error("\"" + path + name + "\" already exists in the torrent");
+
+		merge_file_tree(it->second.dict(), e.dict(), path + name + '/');
+	}
+}
+
+// writes the file tree "orig" with the files in "add" spliced in
+void splice_file_tree(std::vector<char>& out, lt::bdecode_node const& orig
+	, lt::entry::dictionary_type const& add, std::string const& path)
+{
+	splice_dict(out, orig, add
+		, [&](std::string_view const name, lt::bdecode_node const& dir, lt::entry const& e) {
+			std::string const p = path + std::string(name);
+			if (dir.type() != lt::bdecode_node::dict_t
+				|| dir.dict_find_dict("")
+				|| e.dict().count(""))
+			{
+				throw std::runtime_error("\"" + p + "\" already exists in the torrent");
+			}
+			splice_file_tree(out, dir, e.dict(), p + '/');
+		});
+}
+
+// a file (or directory) to be added to the torrent
+struct added_file
+{
+	lt::file_storage fs;
+	std::unique_ptr<lt::create_torrent> creator;
+
+	// true if this is a directory. The file tree of the resulting
+	// torrent then needs to be inserted under the directory's name
+	bool directory = false;
+
+	// for every file in creator->files() that needs hashing, this maps its
+	// index to the entry in the list of files to hash
+	std::vector<std::pair<lt::file_index_t, std::size_t>> hashes;
+};
+
 } // anonymous namespace
 
 int main(int argc_, char const* argv_[]) try
@@ -57,7 +267,11 @@ int main(int argc_, char const* argv_[]) try
 	args = args.subspan(1);
 	std::string output_file = "a.torrent";
 	bool quiet = false;
+	int num_threads = default_num_threads;
+	int hdd_depth = 1;
+	int ssd_depth = 4;
 	lt::create_flags_t flags = lt::create_torrent::v2_only;
+	bool sidecar = false;
 
 	while (args.size() > 0 && args[0][0] == '-') {
 
@@ -65,15 +279,32 @@ int main(int argc_, char const* argv_[]) try
 			output_file = args[1];
 			args = args.subspan(1);
 		}
+		else if (args[0] == "--threads"sv && args.size() > 1) {
+			num_threads = atoi(args[1]);
+			args = args.subspan(1);
+		}
+		else if (args[0] == "--hdd-depth"sv && args.size() > 1) {
+			hdd_depth = std::max(1, atoi(args[1]));
+			args = args.subspan(1);
+		}
+		else if (args[0] == "--ssd-depth"sv && args.size() > 1) {
+			ssd_depth = std::max(1, atoi(args[1]));
+			args = args.subspan(1);
+		}
 		else if (args[0] == "-q"sv) {
 			quiet = true;
 		}
+		else if (args[0] == "--sidecar"sv) {
+			sidecar = true;
+		}
 		else if (args[0] == "-m"sv || args[0] == "--mtime"sv) {
 			flags |= lt::create_torrent::modification_time;
 		}
 		else if (args[0] == "-l"sv || args[0] == "--dont-follow-links"sv) {
 			flags |= lt::create_torrent::symlinks;
 		}
+		else if (stats::parse_option(args[0])) {
+		}
 		else if (args[0] == "-h"sv || args[0] == "--help"sv) {
 			print_usage();
 			return 0;
@@ -92,56 +323,170 @@ int main(int argc_, char const* argv_[]) try
 		return 1;
 	}
 
+	stats::scoped_timer parse_timer(stats::timer::parse);
 	auto input = load_file(input_file);
 	auto torrent_node = lt::bdecode(input);
-	lt::entry torrent_e(torrent_node);
+	if (torrent_node.type() != lt::bdecode_node::dict_t)
+		throw std::runtime_error("invalid torrent file");
+
+	lt::bdecode_node const info = torrent_node.dict_find_dict("info");
+	if (!info) throw std::runtime_error("invalid torrent file, missing info dictionary");
 
-	int const piece_size = torrent_e["info"]["piece length"].integer();
+	if (!info.dict_find_dict("file tree"))
+		throw std::runtime_error("missing file tree (only v2 torrents are supported)");
 
+	int const piece_size = int(info.dict_find_int_value("piece length"));
+
+	parse_timer.stop();
 	std::cout << "piece size: " << piece_size << '\n';
 
-	auto& p_layers = torrent_e["piece layers"].dict();
-	auto& file_tree = torrent_e["info"]["file tree"].dict();
+	// the new files and their piece layers. These are spliced into the
+	// original torrent at the end
+	lt::entry::dictionary_type p_layers;
+	lt::entry::dictionary_type file_tree;
+
+	// create_torrent holds a reference to the file_storage, which therefore
+	// must not move
+	std::deque<added_file> added;
+	std::vector<file_hashes> to_hash;
 
 	for (auto const file : args) {
 
 		if (!quiet) std::cout << "adding " << file << '\n';
-		lt::file_storage fs;
-		fs.set_piece_length(piece_size);
-		lt::add_files(fs, file, [](std::string const&) { return true; }, flags);
-		lt::create_torrent creator(fs, piece_size, flags);
-
-		auto const num = creator.num_pieces();
-		lt::set_piece_hashes(creator, branch_path(file)
-			, [num, quiet] (lt::piece_index_t const p) {
-				if (quiet) return;
-				std::cout << "\r" << p << "/" << num;
-				std::cout.flush();
-			});
-		if (!quiet) std::cout << "\n";
-
-		auto e = creator.generate();
-
-		auto file_entry = *e["info"]["file tree"].dict().begin();
-		file_tree.insert(std::move(file_entry));
-
-		auto& new_p_layers = e["piece layers"].dict();
+		auto& a = added.emplace_back();
+		a.fs.set_piece_length(piece_size);
+		a.directory = std::filesystem::is_directory(file);
+		if (a.directory) {
+			for (auto const& f : walk_directory(file, num_threads, flags)) {
+				a.fs.add_file(f.path, f.size, f.flags
+					, (flags & lt::create_torrent::modification_time) ? f.mtime : 0
+					, f.symlink);
+			}
+			if (!quiet) std::cout << "  " << a.fs.num_files() << " files\n";
+			if (a.fs.num_files() == 0) {
+				added.pop_back();
+				continue;
+			}
+		}
+		else {
+			stats::scoped_timer timer(stats::timer::stat);
+			lt::add_files(a.fs, file, [](std::string const&) { return true; }, flags);
+		}
+		a.creator = std::make_unique<lt::create_torrent>(a.fs, piece_size, flags);
+
+		lt::file_storage const& fs = a.creator->files();
+		std::string const base = branch_path(file);
+		for (auto const i : fs.file_range()) {
+			if (fs.pad_file_at(i)) continue;
+			if (fs.file_flags(i) & lt::file_storage::flag_symlink) continue;
+			if (fs.file_size(i) == 0) continue;
+			a.hashes.emplace_back(i, to_hash.size());
+			auto& h = to_hash.emplace_back();
+			h.path = fs.file_path(i, base);
+			h.size = fs.file_size(i);
+		}
+	}
+
+	// hash all files in one go, to have them share the same thread pool. Each
+	// device is read from independently
+	{
+		bool const show_progress = !quiet && stdout_is_tty();
+		device_table devices;
+		std::int64_t total_size = 0;
+		for (auto& h : to_hash) {
+			total_size += h.size;
+			h.device = devices.lookup(h.path);
+		}
+		read_options ropts;
+		ropts.device_depth = devices.read_depth(hdd_depth, ssd_depth);
+		progress_reporter progress(total_size, int(to_hash.size()), devices.names(), show_progress);
+		hash_files(to_hash, piece_size, num_threads, &progress, {}, ropts);
+	}
+
+	// insert the new files in the order they were specified on the command
+	// line
+	for (auto& a : added) {
+
+		for (auto const& [i, h] : a.hashes) {
+			auto const& layer = to_hash[h].piece_layer;
+			for (std::size_t p = 0; p < layer.size(); ++p)
+				a.creator->set_hash2(i, lt::piece_index_t::diff_type(int(p)), layer[p]);
+		}
+
+		auto e = a.creator->generate();
+
+		// the file tree of a multi-file torrent is relative to its name, i.e.
+		// the directory
+		auto& new_tree = e["info"]["file tree"].dict();
+		if (a.directory) {
+			lt::entry::dictionary_type dir;
+			dir.emplace(e["info"]["name"].string(), lt::entry(std::move(new_tree)));
+			merge_file_tree(file_tree, dir, "");
+		}
+		else {
+			merge_file_tree(file_tree, new_tree, "");
+		}
+
 		// not all files have a piece layer. Small ones for instance
-		if (!new_p_layers.empty())
-			p_layers.insert(std::move(*new_p_layers.begin()));
+		for (auto& l : e["piece layers"].dict())
+			p_layers.insert(std::move(l));
 	}
 
+	// Everything from the original torrent is copied verbatim, except the
+	// directories in the file tree that got new files and the piece layers
+	// dictionary, which get the new entries spliced in.
+	stats::scoped_timer encode_timer(stats::timer::encode);
 	std::vector<char> torrent;
-	lt::bencode(back_inserter(torrent), torrent_e);
+	torrent.reserve(input.size() + to_hash.size() * 200 + std::size_t(lt::sha256_hash::size())
+		* std::accumulate(to_hash.begin(), to_hash.end(), std::size_t(0)
+			, [](std::size_t const acc, file_hashes const& h) { return acc + h.piece_layer.size(); }));
+
+	lt::entry::dictionary_type info_add;
+	info_add.emplace("file tree", lt::entry(std::move(file_tree)));
+
+	lt::entry::dictionary_type torrent_add;
+	torrent_add.emplace("info", lt::entry(lt::entry::dictionary_t));
+	if (!p_layers.empty())
+		torrent_add.emplace("piece layers", lt::entry(std::move(p_layers)));
+
+	splice_dict(torrent, torrent_node, torrent_add
+		, [&](std::string_view const key, lt::bdecode_node const& orig, lt::entry const& e) {
+			if (key == "info"sv) {
+				splice_dict(torrent, orig, info_add
+					, [&](std::string_view, lt::bdecode_node const& tree, lt::entry const& new_tree) {
+						splice_file_tree(torrent, tree, new_tree.dict(), "");
+					});
+			}
+			else if (orig.type() == lt::bdecode_node::dict_t) {
+				// piece layers are keyed by the file's root hash. If the same
+				// file already exists, so does its piece layer
+				splice_dict(torrent, orig, e.dict()
+					, [&](std::string_view, lt::bdecode_node const& layer, lt::entry const&) {
+						write_node(torrent, layer);
+					});
+			}
+			else {
+				write_entry(torrent, e);
+			}
+		});
+
+	encode_timer.stop();
+
+	if (!quiet) std::cout << "-> writing to " << output_file << "\n";
+
+	stats::scoped_timer timer(stats::timer::write);
 	std::fstream out;
 	out.exceptions(std::ifstream::failbit);
 	out.open(output_file.c_str(), std::ios_base::out | std::ios_base::binary);
-
-	if (!quiet) std::cout << "-> writing to " << output_file << "\n";
 	out.write(torrent.data(), int(torrent.size()));
+	stats::add(stats::counter::bytes_written, std::int64_t(torrent.size()));
+	timer.stop();
+
+	if (sidecar) save_sidecar(output_file + ".sidecar", torrent);
 }
 catch (std::exception const& e)
 {
 	std::cerr << "failed: " << e.what() << '\n';
+	return 1;
 }
 
@@ -10,11 +10,18 @@ see LICENSE file.
 #pragma once
 
 #include "libtorrent/version.hpp"
+#include "libtorrent/torrent_info.hpp" // for load_torrent_limits
+#include "libtorrent/span.hpp"
 
 #include <functional> // for std::hash
 #include <string>
 #include <vector>
 #include <fstream>
+#include <string_view>
+#include <cstdlib> // for atoi
+#include <cstdio> // for snprintf
+#include <iterator> // for std::size
+#include <stdexcept>
 
 #if LIBTORRENT_VERSION_NUM <= 20002
 
@@ -49,6 +56,28 @@ inline std::vector<char> load_file(std::string const& filename)
 	return ret;
 }
 
+// parses the options controlling the limits of loading torrent files (listed
+// under "PARSE OPTIONS" in the usage of the tools that support them). Returns
+// true if args[0] is one of them, in which case its argument is consumed
+inline bool parse_load_limit(lt::span<char const*>& args, lt::load_torrent_limits& cfg)
+{
+	using namespace std::string_view_literals;
+
+	if (args.size() < 2) return false;
+	if (args[0] == "--items-limit"sv)
+		cfg.max_decode_tokens = std::atoi(args[1]);
+	else if (args[0] == "--depth-limit"sv)
+		cfg.max_decode_depth = std::atoi(args[1]);
+	else if (args[0] == "--max-pieces"sv)
+		cfg.max_pieces = std::atoi(args[1]);
+	else if (args[0] == "--max-size"sv)
+		cfg.max_buffer_size = std::atoi(args[1]) * 1024 * 1024;
+	else
+		return false;
+	args = args.subspan(1);
+	return true;
+}
+
 inline std::string branch_path(std::string const& f)
 {
 	if (f.empty()) return f;
@@ -104,3 +133,34 @@ inline std::string replace_directory_element(std::string const& path, std::strin
 #endif
 }
 
+// formats a number of bytes with one decimal and an SI prefix, e.g. "1.5 GB"
+inline std::string format_size(std::int64_t const bytes)
+{
+	char const* const prefix[] = {"B", "kB", "MB", "GB", "TB", "PB"};
+	double v = double(bytes);
+	std::size_t i = 0;
+	for (; v >= 1000.0 && i < std::size(prefix) - 1; ++i) v /= 1000.0;
+	char buf[40];
+	std::snprintf(buf, sizeof(buf), "%.1f %s", v, prefix[i]);
+	return buf;
+}
+
+// parses a number of bytes, with an optional k, m or g suffix (powers of 1024)
+inline std::int64_t parse_size(char const* str)
+{
+	char* end = nullptr;
+	std::int64_t ret = std::strtoll(str, &end, 10);
+	switch (*end) {
+		case 'g': case 'G': ret *= 1024;
+			[[fallthrough]];
+		case 'm': case 'M': ret *= 1024;
+			[[fallthrough]];
+		case 'k': case 'K': ret *= 1024;
+			++end;
+			break;
+		default: break;
+	}
+	if (end == str || *end != '\0')
+		throw std::runtime_error("invalid size: " + std::string(str));
+	return ret;
+}
@@ -0,0 +1,567 @@
+/*
+
+Copyright (c) 2026, Arvid Norberg
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string_view>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <array>
+#include <queue>
+#include <algorithm>
+#include <filesystem>
+#include <cstdint>
+#include <cstdio> // for snprintf
+
+#include "libtorrent/torrent_info.hpp"
+#include "libtorrent/span.hpp"
+
+#include "common.hpp"
+
+using namespace std::string_view_literals;
+
+namespace {
+
+int const default_num_threads
+	= std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+void print_usage()
+{
+	std::cout << R"(USAGE: torrent-dedup [OPTIONS] torrent-files...
+OPTIONS:
+--list <file>             Read the paths of the torrent files to analyze from
+                          <file>, one per line. "-" reads from stdin.
+--pieces                  Also report duplicate pieces, across all files
+--print-duplicates        Print every set of duplicate files
+--tmp-dir <dir>           Store temporary files in <dir>. Defaults to the
+                          current directory.
+--memory <MB>             The amount of memory to use for aggregating hashes.
+                          Defaults to 256 MB.
+--threads <n>             Use <n> threads to load torrents. Defaults to )"
+	<< default_num_threads << R"(.
+-h, --help                Show this message
+
+PARSE OPTIONS:
+--items-limit <count>     Set the upper limit of the number of bencode items
+                          in the torrent file.
+--depth-limit <count>     Set the recursion limit in the bdecoder
+--max-pieces <count>      Set the upper limit on the number of pieces to
+                          load in the torrent.
+--max-size <size>         Reject files larger than this size limit, specified
+                          in MB
+
+Reports files that are duplicated across the torrents (by their v2 pieces
+root) and how many bytes could be saved by storing them only once. With
+--pieces, the same is done for the pieces in the files' piece layers (this
+includes the pieces of duplicate files).
+
+The hashes are not held in memory. They are written to temporary files,
+partitioned by hash, and each partition is aggregated separately. Partitions
+that are larger than the memory limit are split further, or sorted on disk if
+that doesn't split them (e.g. when most hashes are the same). v1-only torrents
+are skipped, since they don't have per-file hashes.
+)";
+}
+
+// a file in one of the torrents, identified by its root hash
+struct file_record
+{
+	lt::sha256_hash hash;
+	std::int64_t size;
+	std::uint32_t torrent;
+	std::string path;
+
+	void write(std::string& out) const
+	{
+		out.append(hash.data(), hash.size());
+		out.append(reinterpret_cast<char const*>(&size), sizeof(size));
+		out.append(reinterpret_cast<char const*>(&torrent), sizeof(torrent));
+		std::uint32_t const len = std::uint32_t(path.size());
+		out.append(reinterpret_cast<char const*>(&len), sizeof(len));
+		out.append(path);
+	}
+
+	bool read(std::istream& in)
+	{
+		std::uint32_t len;
+		if (!in.read(hash.data(), hash.size())) return false;
+		in.read(reinterpret_cast<char*>(&size), sizeof(size));
+		in.read(reinterpret_cast<char*>(&torrent), sizeof(torrent));
+		in.read(reinterpret_cast<char*>(&len), sizeof(len));
+		path.resize(len);
+		in.read(&path[0], len);
+		return bool(in);
+	}
+};
+
+// a v2 piece, from a piece layer
+struct piece_record
+{
+	lt::sha256_hash hash;
+	std::uint32_t size;
+
+	void write(std::string& out) const
+	{
+		out.append(hash.data(), hash.size());
+		out.append(reinterpret_cast<char const*>(&size), sizeof(size));
+	}
+
+	bool read(std::istream& in)
+	{
+		if (!in.read(hash.data(), hash.size())) return false;
+		return bool(in.read(reinterpret_cast<char*>(&size), sizeof(size)));
+	}
+};
+
+int const num_partitions = 256;
+
+std::string partition_name(std::string const& base, int const p)
+{
+	char suffix[8];
+	std::snprintf(suffix, sizeof(suffix), ".%02x", p);
+	return base + suffix;
+}
+
+// the records are written to one of 256 files, picked by the byte at "depth"
+// of their hash
+struct partitioned_files
+{
+	partitioned_files(std::string base, int const depth)
+		: m_base(std::move(base)), m_depth(depth)
+	{
+		for (int i = 0; i < num_partitions; ++i) {
+			m_files[std::size_t(i)].exceptions(std::ofstream::failbit | std::ofstream::badbit);
+			m_files[std::size_t(i)].open(partition_name(m_base, i)
+				, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+		}
+	}
+
+	// "rec" is a serialized record, starting with the hash
+	void write(std::string_view const rec)
+	{
+		auto const p = std::uint8_t(rec[std::size_t(m_depth)]);
+		m_files[p].write(rec.data(), std::streamsize(rec.size()));
+		++m_count[p];
+	}
+
+	void close() { for (auto& f : m_files) f.close(); }
+
+	std::string const& base() const { return m_base; }
+
+	// the number of records written to partition "p"
+	std::int64_t count(int const p) const { return m_count[std::size_t(p)]; }
+
+private:
+	std::string m_base;
+	int m_depth;
+	std::array<std::ofstream, num_partitions> m_files;
+	std::array<std::int64_t, num_partitions> m_count{};
+};
+
+template <typename Record>
+bool hash_less(Record const& lhs, Record const& rhs) { return lhs.hash < rhs.hash; }
+
+// sorts the records in "path" by hash, without holding more than "chunk" of
+// them in memory. Sorted runs of "chunk" records are written to temporary
+// files, which are then merged back into "path"
+template <typename Record>
+void sort_records(std::string const& path, std::size_t const chunk)
+{
+	namespace fs = std::filesystem;
+
+	std::vector<std::string> runs;
+	{
+		std::ifstream in(path, std::ios_base::binary);
+		std::vector<Record> records;
+		std::string buf;
+		for (;;) {
+			records.clear();
+			Record r;
+			while (records.size() < chunk && r.read(in)) records.push_back(std::move(r));
+			if (records.empty()) break;
+			std::sort(records.begin(), records.end(), &hash_less<Record>);
+			buf.clear();
+			for (auto const& rec : records) rec.write(buf);
+			runs.push_back(partition_name(path + ".run", int(runs.size())));
+			std::ofstream out;
+			out.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+			out.open(runs.back(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+			out.write(buf.data(), std::streamsize(buf.size()));
+		}
+	}
+
+	std::vector<std::ifstream> in(runs.size());
+	std::vector<Record> heads(runs.size());
+	auto const cmp = [&](std::size_t const lhs, std::size_t const rhs)
+		{ return hash_less(heads[rhs], heads[lhs]); };
+	std::priority_queue<std::size_t, std::vector<std::size_t>, decltype(cmp)> queue(cmp);
+	for (std::size_t i = 0; i < runs.size(); ++i) {
+		in[i].open(runs[i], std::ios_base::binary);
+		if (heads[i].read(in[i])) queue.push(i);
+	}
+
+	std::ofstream out;
+	out.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+	out.open(path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+	std::string buf;
+	while (!queue.empty()) {
+		std::size_t const i = queue.top();
+		queue.pop();
+		buf.clear();
+		heads[i].write(buf);
+		out.write(buf.data(), std::streamsize(buf.size()));
+		if (heads[i].read(in[i])) queue.push(i);
+	}
+	out.close();
+	for (std::size_t i = 0; i < runs.size(); ++i) {
+		in[i].close();
+		fs::remove(runs[i]);
+	}
+}
+
+// calls "group" with the records of "path", which must be sorted by hash, in
+// parts of at most "chunk" records. See aggregate()
+template <typename Record, typename Group>
+void group_sorted(std::string const& path, std::size_t const chunk, Group const& group)
+{
+	// "scan" reads ahead, to count the records of the next group, before
+	// they are read (again) by "in"
+	std::ifstream scan(path, std::ios_base::binary);
+	std::ifstream in(path, std::ios_base::binary);
+	Record next;
+	bool more = next.read(scan);
+	std::vector<Record> records;
+	while (more) {
+		lt::sha256_hash const hash = next.hash;
+		std::int64_t count = 0;
+		while (more && next.hash == hash) {
+			++count;
+			more = next.read(scan);
+		}
+		for (std::int64_t offset = 0; offset < count; offset += std::int64_t(records.size())) {
+			records.clear();
+			Record r;
+			while (records.size() < chunk && offset + std::int64_t(records.size()) < count
+				&& r.read(in))
+				records.push_back(std::move(r));
+			if (records.empty()) throw std::runtime_error("failed to read \"" + path + "\"");
+			group(count, offset, lt::span<Record const>(records));
+		}
+	}
+}
+
+// calls "group" with every set of records (in "path") that have the same
+// hash, as group(count, offset, records). "count" is the number of records in
+// the set, which may be passed in parts, "offset" is the index of the first of
+// "records" within it. Files larger than "budget" bytes are split into 256
+// partitions by the next byte of the hash, which are aggregated one at a time.
+// If they all fall into the same partition (e.g. because one hash dominates)
+// splitting doesn't help, so they're sorted on disk instead. "path" is removed
+template <typename Record, typename Group>
+void aggregate(std::string const& path, int const depth, std::int64_t const budget
+	, Group const& group)
+{
+	namespace fs = std::filesystem;
+
+	// the records take more space in memory than on disk
+	if (std::int64_t(fs::file_size(path)) * 2 > budget) {
+		std::size_t const chunk = std::size_t(std::max(std::int64_t(1)
+			, budget / 2 / std::int64_t(sizeof(Record))));
+		bool same_hash = true;
+		if (depth < int(lt::sha256_hash::size())) {
+			int used = 0;
+			{
+				partitioned_files parts(path, depth);
+				std::ifstream in(path, std::ios_base::binary);
+				Record r;
+				lt::sha256_hash first;
+				std::string buf;
+				for (bool empty = true; r.read(in); empty = false) {
+					if (empty) first = r.hash;
+					else if (r.hash != first) same_hash = false;
+					buf.clear();
+					r.write(buf);
+					parts.write(buf);
+				}
+				parts.close();
+				for (int i = 0; i < num_partitions; ++i)
+					if (parts.count(i) > 0) ++used;
+			}
+			if (used > 1) {
+				fs::remove(path);
+				for (int i = 0; i < num_partitions; ++i)
+					aggregate<Record>(partition_name(path, i), depth + 1, budget, group);
+				return;
+			}
+			// the partitions are copies of "path", or empty
+			for (int i = 0; i < num_partitions; ++i)
+				fs::remove(partition_name(path, i));
+		}
+
+		// all records with the same hash are already sorted
+		if (!same_hash) sort_records<Record>(path, chunk);
+		group_sorted<Record>(path, chunk, group);
+		fs::remove(path);
+		return;
+	}
+
+	std::vector<Record> records;
+	{
+		std::ifstream in(path, std::ios_base::binary);
+		Record r;
+		while (r.read(in)) records.push_back(std::move(r));
+	}
+	fs::remove(path);
+
+	std::sort(records.begin(), records.end(), &hash_less<Record>);
+
+	for (auto i = records.begin(); i != records.end();) {
+		auto const end = std::find_if(i, records.end()
+			, [&](Record const& r) { return r.hash != i->hash; });
+		group(std::int64_t(end - i), std::int64_t(0), lt::span<Record const>(&*i, end - i));
+		i = end;
+	}
+}
+
+// the result of aggregating one kind of records
+struct duplicates
+{
+	// the number of records that have at least one duplicate
+	std::int64_t count = 0;
+	// the number of distinct hashes with duplicates
+	std::int64_t groups = 0;
+	// the bytes that would be saved by storing every hash only once
+	std::int64_t redundant_bytes = 0;
+};
+
+}
+
+int main(int argc, char const* argv[]) try
+{
+	lt::span<char const*> args(argv, argc);
+	// strip executable name
+	args = args.subspan(1);
+
+	lt::load_torrent_limits cfg;
+	std::string list_file;
+	std::string tmp_dir = ".";
+	std::int64_t budget = 256 * 1024 * 1024;
+	int num_threads = default_num_threads;
+	bool analyze_pieces = false;
+	bool print_duplicates = false;
+
+	if (args.empty()) {
+		print_usage();
+		return 1;
+	}
+
+	while (!args.empty() && args[0][0] == '-') {
+		if (args[0] == "--list"sv && args.size() > 1) {
+			list_file = args[1];
+			args = args.subspan(1);
+		}
+		else if (args[0] == "--pieces"sv) {
+			analyze_pieces = true;
+		}
+		else if (args[0] == "--print-duplicates"sv) {
+			print_duplicates = true;
+		}
+		else if (args[0] == "--tmp-dir"sv && args.size() > 1) {
+			tmp_dir = args[1];
+			args = args.subspan(1);
+		}
+		else if (args[0] == "--memory"sv && args.size() > 1) {
+			budget = std::int64_t(atoi(args[1])) * 1024 * 1024;
+			args = args.subspan(1);
+		}
+		else if (args[0] == "--threads"sv && args.size() > 1) {
+			num_threads = atoi(args[1]);
+			args = args.subspan(1);
+		}
+		else if (parse_load_limit(args, cfg)) {
+		}
+		else if (args[0] == "-h"sv || args[0] == "--help"sv) {
+			print_usage();
+			return 0;
+		}
+		else {
+			std::cerr << "unknown option " << args[0] << '\n';
+			print_usage();
+			return 1;
+		}
+		args = args.subspan(1);
+	}
+
+	// the torrent files are referred to by index in the records
+	std::vector<std::string> torrents(args.begin(), args.end());
+	if (!list_file.empty()) {
+		std::ifstream list_stream;
+		if (list_file != "-") list_stream.open(list_file);
+		std::istream& in = list_file == "-" ? std::cin : list_stream;
+		if (!in) throw std::runtime_error("failed to open " + list_file);
+		std::string line;
+		while (std::getline(in, line)) {
+			if (!line.empty()) torrents.push_back(line);
+		}
+	}
+
+	if (torrents.empty()) {
+		print_usage();
+		return 1;
+	}
+
+	std::filesystem::create_directories(tmp_dir);
+	std::string const files_base = (std::filesystem::path(tmp_dir) / "torrent-dedup-files").string();
+	std::string const pieces_base = (std::filesystem::path(tmp_dir) / "torrent-dedup-pieces").string();
+
+	std::atomic<std::size_t> next_torrent{0};
+	std::atomic<int> skipped{0};
+	std::atomic<int> failed{0};
+	std::atomic<std::int64_t> total_files{0};
+	std::atomic<std::int64_t> total_size{0};
+	std::atomic<std::int64_t> total_pieces{0};
+
+	{
+		partitioned_files files_out(files_base, 0);
+		std::unique_ptr<partitioned_files> pieces_out;
+		if (analyze_pieces) pieces_out = std::make_unique<partitioned_files>(pieces_base, 0);
+		std::mutex mutex;
+
+		auto worker = [&] {
+			// the serialized records of one torrent, written to the partitions
+			// in one go
+			std::string file_buf;
+			std::vector<std::size_t> file_offsets;
+			std::string piece_buf;
+			for (;;) {
+				std::size_t const idx = next_torrent++;
+				if (idx >= torrents.size()) break;
+
+				file_buf.clear();
+				file_offsets.clear();
+				piece_buf.clear();
+				try {
+					lt::torrent_info const t(torrents[idx], cfg);
+					if (!t.info_hashes().has_v2()) {
+						++skipped;
+						continue;
+					}
+					lt::file_storage const& fs = t.files();
+					int const piece_size = fs.piece_length();
+					for (auto const f : fs.file_range()) {
+						if (fs.pad_file_at(f) || fs.file_size(f) == 0) continue;
+						++total_files;
+						total_size += fs.file_size(f);
+						file_offsets.push_back(file_buf.size());
+						file_record{fs.root(f), fs.file_size(f), std::uint32_t(idx), fs.file_path(f)}
+							.write(file_buf);
+
+						if (!analyze_pieces) continue;
+						auto const layer = t.piece_layer(f);
+						int const num_pieces = int(layer.size() / int(lt::sha256_hash::size()));
+						for (int p = 0; p < num_pieces; ++p) {
+							std::int64_t const remaining = fs.file_size(f) - std::int64_t(p) * piece_size;
+							piece_record{lt::sha256_hash(layer.data() + p * int(lt::sha256_hash::size()))
+								, std::uint32_t(std::min(std::int64_t(piece_size), remaining))}
+								.write(piece_buf);
+						}
+						total_pieces += num_pieces;
+					}
+				}
+				catch (std::exception const& e) {
+					++failed;
+					std::lock_guard<std::mutex> l(mutex);
+					std::cerr << "failed to load " << torrents[idx] << ": " << e.what() << '\n';
+					continue;
+				}
+
+				std::lock_guard<std::mutex> l(mutex);
+				file_offsets.push_back(file_buf.size());
+				for (std::size_t i = 0; i + 1 < file_offsets.size(); ++i) {
+					files_out.write(std::string_view(file_buf).substr(file_offsets[i]
+						, file_offsets[i + 1] - file_offsets[i]));
+				}
+				// piece records have a fixed size
+				std::size_t const piece_record_size = lt::sha256_hash::size() + sizeof(std::uint32_t);
+				for (std::size_t i = 0; i < piece_buf.size(); i += piece_record_size)
+					pieces_out->write(std::string_view(piece_buf).substr(i, piece_record_size));
+			}
+		};
+
+		int const threads = std::max(1, std::min(num_threads, int(torrents.size())));
+		std::vector<std::thread> pool;
+		for (int i = 1; i < threads; ++i) pool.emplace_back(worker);
+		worker();
+		for (auto& t : pool) t.join();
+
+		files_out.close();
+		if (pieces_out) pieces_out->close();
+	}
+
+	duplicates dup_files;
+	for (int i = 0; i < num_partitions; ++i) {
+		aggregate<file_record>(partition_name(files_base, i), 1, budget
+			, [&](std::int64_t const count, std::int64_t const offset
+				, lt::span<file_record const> group) {
+				if (count < 2) return;
+				if (offset == 0) {
+					dup_files.count += count;
+					dup_files.groups += 1;
+					dup_files.redundant_bytes += (count - 1) * group[0].size;
+					if (print_duplicates) {
+						std::cout << group[0].hash << " " << group[0].size << " bytes, "
+							<< count << " copies:\n";
+					}
+				}
+				if (!print_duplicates) return;
+				for (auto const& r : group)
+					std::cout << "   " << torrents[r.torrent] << ": " << r.path << '\n';
+			});
+	}
+
+	duplicates dup_pieces;
+	if (analyze_pieces) {
+		for (int i = 0; i < num_partitions; ++i) {
+			aggregate<piece_record>(partition_name(pieces_base, i), 1, budget
+				, [&](std::int64_t const count, std::int64_t const offset
+					, lt::span<piece_record const> group) {
+					if (count < 2) return;
+					if (offset == 0) {
+						dup_pieces.count += count;
+						dup_pieces.groups += 1;
+					}
+					// every copy but the first is redundant
+					for (auto const& r : offset == 0 ? group.subspan(1) : group)
+						dup_pieces.redundant_bytes += r.size;
+				});
+		}
+	}
+
+	std::cout << "torrents: " << torrents.size() << " (" << skipped << " v1-only skipped, "
+		<< failed << " failed to load)\n"
+		<< "files: " << total_files << " (" << format_size(total_size) << ")\n"
+		<< "duplicate files: " << dup_files.count << " in " << dup_files.groups
+		<< " groups, " << format_size(dup_files.redundant_bytes) << " (" << dup_files.redundant_bytes
+		<< " bytes) redundant\n";
+	if (analyze_pieces) {
+		std::cout << "pieces: " << total_pieces << '\n'
+			<< "duplicate pieces: " << dup_pieces.count << " in " << dup_pieces.groups
+			<< " groups, " << format_size(dup_pieces.redundant_bytes) << " (" << dup_pieces.redundant_bytes
+			<< " bytes) redundant\n";
+	}
+
+	return 0;
+}
+catch (std::exception const& e)
+{
+	std::cerr << "failed: " << e.what() << '\n';
+	return 1;
+}
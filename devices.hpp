@@ -0,0 +1,180 @@
+/*
+
+Copyright (c) 2026, Arvid Norberg
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined __linux__
+#include <sys/sysmacros.h> // for major, minor (in sys/types.h elsewhere)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h> // for FS_IOC_FIEMAP
+#include <linux/fiemap.h>
+#endif
+
+// maps files to the device (i.e. file system) they are stored on. Devices are
+// numbered from 0, in the order they are first seen
+struct device_table
+{
+	// returns the device "path" is stored on. Only the parent directory is
+	// stat()ed, and cached, since all files in a directory (except mount
+	// points) are stored on the same device as it. Paths that cannot be
+	// stat()ed are mapped to device 0, the error is left to whoever opens them
+	int lookup(std::string const& path)
+	{
+		auto const slash = path.find_last_of("/\\");
+		std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+		auto const it = m_dirs.find(dir);
+		if (it != m_dirs.end()) return it->second;
+
+		struct stat st;
+		int dev = 0;
+		if (::stat(dir.c_str(), &st) == 0) {
+			auto const [d, inserted] = m_devices.emplace(std::uint64_t(st.st_dev), int(m_names.size()));
+			if (inserted) {
+				m_names.push_back(device_name(st.st_dev));
+				m_rotational.push_back(is_rotational(st.st_dev));
+			}
+			dev = d->second;
+		}
+		else if (m_names.empty()) {
+			m_names.push_back("?");
+			m_rotational.push_back(false);
+		}
+		m_dirs.emplace(std::move(dir), dev);
+		return dev;
+	}
+
+	std::vector<std::string> const& names() const { return m_names; }
+
+	// whether the device is a spinning disk
+	bool rotational(int const device) const { return m_rotational[std::size_t(device)]; }
+
+	// the number of concurrent reads to issue to each device. Spinning disks
+	// get fewer, since more than one stream of reads makes them seek
+	std::vector<int> read_depth(int const hdd_depth, int const ssd_depth) const
+	{
+		std::vector<int> ret;
+		for (bool const r : m_rotational) ret.push_back(r ? hdd_depth : ssd_depth);
+		return ret;
+	}
+
+private:
+
+	static std::string device_name(dev_t const dev)
+	{
+#if defined _WIN32
+		return std::to_string(dev);
+#else
+		return std::to_string(major(dev)) + ":" + std::to_string(minor(dev));
+#endif
+	}
+
+	// devices that aren't block devices (network file systems, tmpfs) and
+	// anything we can't tell, are assumed to not be spinning disks
+	static bool is_rotational(dev_t const dev)
+	{
+#if defined __linux__
+		if (major(dev) == 0) return false;
+		std::string const base = "/sys/dev/block/" + device_name(dev);
+		// partitions don't have a queue of their own, their disk does
+		for (char const* q : {"/queue/rotational", "/../queue/rotational"}) {
+			std::ifstream in(base + q);
+			int r = 0;
+			if (in >> r) return r != 0;
+		}
+		return false;
+#else
+		(void)dev;
+		return false;
+#endif
+	}
+
+	std::unordered_map<std::string, int> m_dirs;
+	std::unordered_map<std::uint64_t, int> m_devices;
+	std::vector<std::string> m_names;
+	std::vector<bool> m_rotational;
+};
+
+// the physical offset of the start of the file on its device, to be able to
+// read files in the order they are laid out on disk. Returns 0 if it's not
+// known, e.g. if the file system doesn't support FIEMAP
+inline std::uint64_t physical_offset(std::string const& path)
+{
+#if defined __linux__ && defined FS_IOC_FIEMAP
+	int const fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return 0;
+	// room for the header and the first extent
+	alignas(struct fiemap) char buf[sizeof(struct fiemap) + sizeof(struct fiemap_extent)] = {};
+	auto* map = reinterpret_cast<struct fiemap*>(buf);
+	map->fm_start = 0;
+	map->fm_length = FIEMAP_MAX_OFFSET;
+	map->fm_extent_count = 1;
+	int const ret = ::ioctl(fd, FS_IOC_FIEMAP, map);
+	::close(fd);
+	if (ret != 0 || map->fm_mapped_extents == 0) return 0;
+	return map->fm_extents[0].fe_physical;
+#else
+	(void)path;
+	return 0;
+#endif
+}
+
+// returns the map of where the content of the file is stored on its device
+// (every extent's logical offset, physical offset, length and flags), in an
+// opaque form. Two files on the same device with the same size and extent map
+// share all their storage (e.g. reflinked copies), and so have the same
+// content. Returns an empty string if it's not known, or if any extent has a
+// location that isn't exact (inline, compressed, not yet allocated etc.)
+inline std::string extent_map(std::string const& path)
+{
+#if defined __linux__ && defined FS_IOC_FIEMAP
+	int const fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return {};
+	// files with more extents than this are not worth the trouble
+	int const max_extents = 256;
+	std::vector<char> buf(sizeof(struct fiemap) + sizeof(struct fiemap_extent) * max_extents);
+	auto* map = reinterpret_cast<struct fiemap*>(buf.data());
+	map->fm_start = 0;
+	map->fm_length = FIEMAP_MAX_OFFSET;
+	// flush delayed allocations first, for them to have a location
+	map->fm_flags = FIEMAP_FLAG_SYNC;
+	map->fm_extent_count = max_extents;
+	int const ret = ::ioctl(fd, FS_IOC_FIEMAP, map);
+	::close(fd);
+	if (ret != 0 || map->fm_mapped_extents == 0) return {};
+	auto const& last = map->fm_extents[map->fm_mapped_extents - 1];
+	if (!(last.fe_flags & FIEMAP_EXTENT_LAST)) return {};
+
+	std::uint32_t const inexact = FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC
+		| FIEMAP_EXTENT_ENCODED | FIEMAP_EXTENT_DATA_ENCRYPTED | FIEMAP_EXTENT_NOT_ALIGNED
+		| FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_DATA_TAIL;
+	std::string ret_map;
+	for (std::uint32_t i = 0; i < map->fm_mapped_extents; ++i) {
+		auto const& e = map->fm_extents[i];
+		if (e.fe_flags & inexact) return {};
+		for (std::uint64_t const v : {std::uint64_t(e.fe_logical), std::uint64_t(e.fe_physical)
+			, std::uint64_t(e.fe_length), std::uint64_t(e.fe_flags)})
+			ret_map.append(reinterpret_cast<char const*>(&v), sizeof(v));
+	}
+	return ret_map;
+#else
+	(void)path;
+	return {};
+#endif
+}
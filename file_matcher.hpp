@@ -0,0 +1,340 @@
+/*
+
+Copyright (c) 2026, Arvid Norberg
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#pragma once
+
+#include "libtorrent/file_storage.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <regex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// a set of glob patterns compiled into a single NFA, simulated bit-parallel
+// (one bit per state). Matching a string is linear in its length, times the
+// number of 64 bit words needed to hold the states of all patterns.
+//
+// each pattern is a sequence of tokens, state i means the first i tokens have
+// been matched. Tokens either consume one character (moving to the next
+// state) or are stars, which may consume any number of characters (staying
+// in the same state) or be skipped. A "**/" is a star followed by a "/",
+// where both may be skipped together, to also match zero directories.
+struct glob_set
+{
+	// adds "pattern", identified by "rule". The supported syntax is:
+	// * matches anything except "/", ** matches anything, ? matches a single
+	// character except "/", [abc], [a-z] and [!abc] match character classes and
+	// \ escapes the next character. "a/**/b" also matches "a/b"
+	void add(std::string_view pattern, int const rule)
+	{
+		struct token { std::array<bool, 256> accept{}; bool star = false; bool skip_dir = false; };
+		std::vector<token> tokens;
+
+		for (std::size_t i = 0; i < pattern.size(); ++i) {
+			token t;
+			char const c = pattern[i];
+			if (c == '*') {
+				bool any = false;
+				while (i + 1 < pattern.size() && pattern[i + 1] == '*') { any = true; ++i; }
+				// consecutive stars are merged into one token, they're
+				// equivalent to a single one
+				if (!tokens.empty() && tokens.back().star) {
+					any = any || tokens.back().accept['/'];
+					tokens.pop_back();
+				}
+				t.star = true;
+				t.accept.fill(true);
+				t.accept['/'] = any;
+				if (any && i + 1 < pattern.size() && pattern[i + 1] == '/'
+					&& (tokens.empty() || !tokens.back().star)) {
+					// "**/" may match nothing. That's an empty star in front
+					// of it, which can skip past the "/". Skipping from the
+					// "**" itself would also skip the "/" after it has matched
+					// something
+					token skip;
+					skip.star = true;
+					skip.skip_dir = true;
+					tokens.push_back(skip);
+					tokens.push_back(t);
+					t = token();
+					t.accept['/'] = true;
+					++i;
+				}
+			}
+			else if (c == '?') {
+				t.accept.fill(true);
+				t.accept['/'] = false;
+			}
+			else if (c == '[') {
+				std::size_t j = i + 1;
+				bool const negate = j < pattern.size() && (pattern[j] == '!' || pattern[j] == '^');
+				if (negate) ++j;
+				std::array<bool, 256> cls{};
+				bool first = true;
+				for (; j < pattern.size() && (first || pattern[j] != ']'); ++j, first = false) {
+					auto lo = std::uint8_t(pattern[j]);
+					auto hi = lo;
+					if (j + 2 < pattern.size() && pattern[j + 1] == '-' && pattern[j + 2] != ']') {
+						hi = std::uint8_t(pattern[j + 2]);
+						j += 2;
+					}
+					for (int k = lo; k <= hi; ++k) cls[std::size_t(k)] = true;
+				}
+				if (j >= pattern.size())
+					throw std::runtime_error("unterminated character class in pattern: " + std::string(pattern));
+				for (std::size_t k = 0; k < 256; ++k) t.accept[k] = cls[k] != negate;
+				t.accept['/'] = false;
+				i = j;
+			}
+			else {
+				std::size_t const k = c == '\\' && i + 1 < pattern.size() ? ++i : i;
+				t.accept[std::uint8_t(pattern[k])] = true;
+			}
+			tokens.push_back(t);
+		}
+
+		int const base = m_num_states;
+		m_num_states += int(tokens.size()) + 1;
+		std::size_t const words = std::size_t(m_num_states + 63) / 64;
+		m_start.resize(words);
+		m_star.resize(words);
+		m_skip_dir.resize(words);
+		m_accept.resize(words);
+		for (auto& m : m_consume) m.resize(words);
+		for (auto& m : m_loop) m.resize(words);
+
+		set_bit(m_start, base);
+		for (std::size_t i = 0; i < tokens.size(); ++i) {
+			int const s = base + int(i);
+			if (tokens[i].star) set_bit(m_star, s);
+			if (tokens[i].skip_dir) set_bit(m_skip_dir, s);
+			auto& masks = tokens[i].star ? m_loop : m_consume;
+			for (std::size_t k = 0; k < 256; ++k)
+				if (tokens[i].accept[k]) set_bit(masks[k], s);
+		}
+		int const accept = base + int(tokens.size());
+		set_bit(m_accept, accept);
+		m_accept_rule.emplace(accept, rule);
+	}
+
+	bool empty() const { return m_num_states == 0; }
+
+	// returns the lowest rule matching all of "str", or -1 if none does
+	int match(std::string_view const str) const
+	{
+		if (empty()) return -1;
+		std::vector<std::uint64_t> state = m_start;
+		std::vector<std::uint64_t> next(state.size());
+		closure(state);
+		for (char const ch : str) {
+			auto const c = std::uint8_t(ch);
+			bool any = false;
+			std::uint64_t carry = 0;
+			for (std::size_t w = 0; w < state.size(); ++w) {
+				std::uint64_t const consumed = state[w] & m_consume[c][w];
+				next[w] = (consumed << 1) | carry | (state[w] & m_loop[c][w]);
+				carry = consumed >> 63;
+				any = any || next[w] != 0;
+			}
+			if (!any) return -1;
+			state.swap(next);
+			closure(state);
+		}
+
+		int ret = -1;
+		for (std::size_t w = 0; w < state.size(); ++w) {
+			std::uint64_t hits = state[w] & m_accept[w];
+			for (int b = 0; hits != 0; ++b, hits >>= 1) {
+				if ((hits & 1) == 0) continue;
+				int const rule = m_accept_rule.at(int(w * 64) + b);
+				if (ret == -1 || rule < ret) ret = rule;
+			}
+		}
+		return ret;
+	}
+
+private:
+
+	static void set_bit(std::vector<std::uint64_t>& v, int const bit)
+	{ v[std::size_t(bit / 64)] |= std::uint64_t(1) << (bit % 64); }
+
+	// stars may match the empty string, i.e. be skipped, and "**/" may be
+	// skipped as a whole. Skipping one may reach another, as in "a/**/**/b",
+	// so this is repeated until no more states are added
+	void closure(std::vector<std::uint64_t>& state) const
+	{
+		for (bool changed = true; changed;) {
+			changed = false;
+			std::uint64_t carry = 0;
+			for (std::size_t w = 0; w < state.size(); ++w) {
+				std::uint64_t const skip = state[w] & m_skip_dir[w];
+				std::uint64_t const s = state[w] | (skip << 3) | carry;
+				carry = skip >> 61;
+				changed = changed || s != state[w];
+				state[w] = s;
+			}
+			carry = 0;
+			for (std::size_t w = 0; w < state.size(); ++w) {
+				std::uint64_t const skip = state[w] & m_star[w];
+				std::uint64_t const s = state[w] | (skip << 1) | carry;
+				carry = skip >> 63;
+				changed = changed || s != state[w];
+				state[w] = s;
+			}
+		}
+	}
+
+	int m_num_states = 0;
+	std::vector<std::uint64_t> m_start;
+	std::vector<std::uint64_t> m_star;
+	// the empty stars in front of "**/", which skip past the "/"
+	std::vector<std::uint64_t> m_skip_dir;
+	std::vector<std::uint64_t> m_accept;
+	// indexed by character. The states that move to the next state, or stay
+	// in the same state (for stars), respectively
+	std::array<std::vector<std::uint64_t>, 256> m_consume;
+	std::array<std::vector<std::uint64_t>, 256> m_loop;
+	std::unordered_map<int, int> m_accept_rule;
+};
+
+// a hash table of exact file names, which can be looked up by string_view
+// without allocating. The keys refer to the names owned by the table, so a copy
+// builds its own keys
+struct name_table
+{
+	name_table() = default;
+	name_table(name_table const& other)
+	{
+		for (auto const& n : other.m_index) add(std::string(n.first), n.second);
+	}
+	name_table(name_table&&) = default;
+	// swapping (or moving) a deque doesn't move its elements
+	name_table& operator=(name_table other)
+	{
+		m_names.swap(other.m_names);
+		m_index.swap(other.m_index);
+		return *this;
+	}
+
+	// if "name" has already been added, it keeps its first rule
+	void add(std::string name, int const rule)
+	{
+		if (m_index.count(name)) return;
+		m_index.emplace(m_names.emplace_back(std::move(name)), rule);
+	}
+
+	// returns the rule of "name", or -1
+	int find(std::string_view const name) const
+	{
+		auto const it = m_index.find(name);
+		return it == m_index.end() ? -1 : it->second;
+	}
+
+	bool empty() const { return m_index.empty(); }
+
+private:
+	std::deque<std::string> m_names;
+	std::unordered_map<std::string_view, int> m_index;
+};
+
+// matches files in a torrent against a list of rules, compiled once up-front.
+// Rules are identified by the order they were added in, and match() returns
+// the first one that matches. Exact file names are looked up in a hash table,
+// glob patterns are all matched in a single pass (see glob_set) and only
+// regular expressions are tried one at a time.
+struct file_matcher
+{
+	// matches files whose name is exactly "name"
+	void add_name(std::string name)
+	{
+		m_names.add(std::move(name), m_num_rules++);
+	}
+
+	// patterns without a "/" are matched against the file name, others
+	// against the full path (which includes the torrent name)
+	void add_glob(std::string_view pattern)
+	{
+		if (pattern.find('/') == std::string_view::npos)
+			m_name_globs.add(pattern, m_num_rules++);
+		else
+			m_path_globs.add(pattern, m_num_rules++);
+	}
+
+	// matches the full path (ECMAScript syntax)
+	void add_regex(std::string const& re)
+	{
+		m_regex.emplace_back(std::regex(re, std::regex::optimize), m_num_rules++);
+	}
+
+	// matches files whose size is in the range [min, max]
+	void add_size(std::int64_t const min, std::int64_t const max)
+	{
+		m_size.push_back({min, max, m_num_rules++});
+	}
+
+	// matches files that have all of "flags" set
+	void add_attributes(lt::file_flags_t const flags)
+	{
+		m_attributes.emplace_back(flags, m_num_rules++);
+	}
+
+	bool empty() const { return m_num_rules == 0; }
+
+	// whether any rule needs the full path of files. If not, an empty path
+	// may be passed to match(), saving the caller from building it
+	bool needs_path() const { return !m_path_globs.empty() || !m_regex.empty(); }
+
+	// returns the index of the first rule matching the file, or -1
+	int match(std::string_view const path, std::string_view const name
+		, std::int64_t const size, lt::file_flags_t const flags) const
+	{
+		int ret = std::numeric_limits<int>::max();
+		auto const found = [&](int const rule) { if (rule >= 0) ret = std::min(ret, rule); };
+
+		if (!m_names.empty()) found(m_names.find(name));
+		found(m_name_globs.match(name));
+		found(m_path_globs.match(path));
+		for (auto const& s : m_size)
+			if (s.rule < ret && size >= s.min && size <= s.max) found(s.rule);
+		for (auto const& a : m_attributes)
+			if (a.second < ret && (flags & a.first) == a.first) found(a.second);
+		for (auto const& r : m_regex) {
+			if (r.second >= ret) break;
+			if (std::regex_search(path.begin(), path.end(), r.first)) found(r.second);
+		}
+		return ret == std::numeric_limits<int>::max() ? -1 : ret;
+	}
+
+	// the regular expression of "rule", or nullptr if it's not a regex rule
+	std::regex const* regex(int const rule) const
+	{
+		for (auto const& r : m_regex)
+			if (r.second == rule) return &r.first;
+		return nullptr;
+	}
+
+private:
+
+	struct size_rule { std::int64_t min; std::int64_t max; int rule; };
+
+	int m_num_rules = 0;
+	name_table m_names;
+	glob_set m_name_globs;
+	glob_set m_path_globs;
+	std::vector<size_rule> m_size;
+	std::vector<std::pair<lt::file_flags_t, int>> m_attributes;
+	std::vector<std::pair<std::regex, int>> m_regex;
+};
@@ -0,0 +1,605 @@
+/*
+
+Copyright (c) 2026, Arvid Norberg
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#pragma once
+
+#include "libtorrent/sha1_hash.hpp" // for sha256_hash
+#include "libtorrent/hasher.hpp"
+#include "libtorrent/file_storage.hpp"
+#include "libtorrent/span.hpp"
+
+#include "merkle.hpp"
+#include "pad_hash.hpp"
+#include "devices.hpp"
+#include "input_file.hpp"
+#include "output_file.hpp"
+#include "progress.hpp"
+#include "stats.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// the v2 hashes of a single file
+struct file_hashes
+{
+	// the path to the file on disk
+	std::string path;
+
+	std::int64_t size = 0;
+
+	// the merkle root of the file
+	lt::sha256_hash root;
+
+	// one hash per piece. Files that are not larger than one piece don't have a
+	// piece layer, for those this holds a single hash, the root (just like
+	// torrent_info::piece_layer() and create_torrent::set_hash2() expect)
+	std::vector<lt::sha256_hash> piece_layer;
+
+	// the device the file is stored on, see device_table. Reads are scheduled
+	// per device
+	int device = 0;
+
+	// where the file starts on its device, see physical_offset(). The files of
+	// a device are read in this order (and in the order they're passed in, if
+	// it's the same)
+	std::uint64_t physical_offset = 0;
+
+	// if set, the v1 piece hashes of the file are computed too, while it's
+	// read for the v2 hashes. This requires the file to start at a piece
+	// boundary, as all files in hybrid torrents do. If v1_pad is set, the last
+	// piece is padded with zeros up to the piece size (i.e. the file is
+	// followed by a pad file)
+	bool v1 = false;
+	bool v1_pad = false;
+	std::vector<lt::sha1_hash> v1_pieces;
+
+	// if set, the file is copied to this path, from the same buffers it's
+	// hashed from, so it's only read once. Pieces that are skipped (see
+	// hash_files()) are not copied
+	std::string copy_to;
+};
+
+// controls how hash_files() reads files
+struct read_options
+{
+	// the number of concurrent reads per device (indexed by
+	// file_hashes::device). If empty, device 0 is read by as many threads as
+	// there are hashing threads
+	std::vector<int> device_depth;
+
+	// the amount of data read by a single job (rounded to whole pieces). Large
+	// files are split into multiple jobs, to be hashed by multiple threads.
+	// Spinning disks benefit from larger reads
+	std::int64_t job_size = 4 * 1024 * 1024;
+
+	// hint the kernel that files are read sequentially, and to read the next
+	// job of a file ahead, while the current one is being handed off
+	bool readahead = false;
+};
+
+namespace hash_detail {
+
+// the amount of data hashed by a single job of hash_v1_pieces()
+std::int64_t const job_size = 4 * 1024 * 1024;
+
+struct job
+{
+	std::size_t file;
+	int first_piece;
+	int end_piece;
+
+	// if not empty, this is a batch of small files (one piece or less each),
+	// read back to back into the same buffer. "file" and the piece range are
+	// not used
+	std::vector<std::size_t> batch;
+};
+
+// the max number of small files in a batch job. Batches are also limited by
+// the buffer size, but with tiny files they would grow so large that few
+// hashing threads could share the work
+std::size_t const max_batch_files = 1024;
+
+// computes the v2 piece hash of a (possibly partial) piece. "num_leafs" is the
+// number of leaves the piece's subtree has
+inline lt::sha256_hash hash_piece(lt::span<char const> buf, std::size_t const num_leafs
+	, std::vector<lt::sha256_hash>& blocks)
+{
+	blocks.clear();
+	for (std::ptrdiff_t i = 0; i < buf.size(); i += merkle_block_size) {
+		auto const len = std::min(std::ptrdiff_t(merkle_block_size), buf.size() - i);
+		blocks.push_back(lt::hasher256(buf.data() + i, int(len)).final());
+	}
+	return merkle_root(blocks, num_leafs);
+}
+
+inline int piece_bytes(file_hashes const& f, int const piece_size, int const p)
+{
+	return int(std::min(std::int64_t(piece_size), f.size - std::int64_t(p) * piece_size));
+}
+
+// writes what was read of "f" to its copy_to path
+inline void copy_out(file_hashes const& f, output_file& out, std::int64_t const offset
+	, char const* buf, std::int64_t const len)
+{
+	try {
+		if (!out.is_open()) out.open(f.copy_to, f.size);
+		stats::scoped_timer timer(stats::timer::write);
+		out.write_at(offset, buf, len);
+	}
+	catch (std::exception const& e) {
+		throw std::runtime_error("failed to copy to \"" + f.copy_to + "\": " + e.what());
+	}
+	stats::add(stats::counter::bytes_written, len);
+}
+
+// closes the copy of "f", which reports write errors that were deferred
+inline void close_copy(file_hashes const& f, output_file& out)
+{
+	try {
+		out.close();
+	}
+	catch (std::exception const& e) {
+		throw std::runtime_error("failed to copy to \"" + f.copy_to + "\": " + e.what());
+	}
+}
+
+// reads the pieces of job "j" into "buf", and copies them if the file has a
+// copy_to path. "in" and "out" are kept open across calls, as long as they're
+// for the same file ("open_file")
+inline void read_job(lt::span<file_hashes const> files, job const& j, int const piece_size
+	, bool const readahead, input_file& in, output_file& out, std::size_t& open_file
+	, char* buf)
+{
+	auto const& f = files[std::ptrdiff_t(j.file)];
+	if (open_file != j.file) {
+		if (open_file != std::size_t(-1)) close_copy(files[std::ptrdiff_t(open_file)], out);
+		open_file = std::size_t(-1);
+		in.open(f.path);
+		open_file = j.file;
+		stats::add(stats::counter::files_opened, 1);
+		if (readahead) in.sequential();
+	}
+	std::int64_t const offset = std::int64_t(j.first_piece) * piece_size;
+	std::int64_t const len = std::min(std::int64_t(j.end_piece - j.first_piece) * piece_size
+		, f.size - offset);
+	{
+		stats::scoped_timer timer(stats::timer::read);
+		in.read(offset, buf, len);
+	}
+	stats::add(stats::counter::bytes_read, len);
+	if (readahead && offset + len < f.size)
+		in.will_need(offset + len, std::min(len, f.size - offset - len));
+	if (!f.copy_to.empty()) copy_out(f, out, offset, buf, len);
+}
+
+// reads all files of the batch job "j" back to back into "buf", with a single
+// read per file, and copies the ones that have a copy_to path. The files are opened relative to their directory, which is
+// usually the same for consecutive ones
+inline void read_batch(lt::span<file_hashes const> files, job const& j
+	, directory_cache& dirs, char* buf)
+{
+	input_file in;
+	for (std::size_t const fi : j.batch) {
+		auto const& f = files[std::ptrdiff_t(fi)];
+		try {
+			in.open(f.path, dirs);
+			stats::add(stats::counter::files_opened, 1);
+			stats::scoped_timer timer(stats::timer::read);
+			in.read(0, buf, f.size);
+		}
+		catch (std::exception const& e) {
+			throw std::runtime_error("failed to hash \"" + f.path + "\": " + e.what());
+		}
+		stats::add(stats::counter::bytes_read, f.size);
+		if (!f.copy_to.empty()) {
+			output_file out;
+			copy_out(f, out, 0, buf, f.size);
+			close_copy(f, out);
+		}
+		buf += f.size;
+	}
+}
+
+// hashes the pieces of job "j", read into "buf". Returns false if the
+// remaining pieces of the file were skipped, because "piece_hashed" asked to
+// stop
+inline bool hash_job(file_hashes& f, job const& j, int const piece_size
+	, char* buf, std::vector<lt::sha256_hash>& blocks
+	, progress_reporter* progress
+	, std::function<bool(std::size_t, int, lt::sha256_hash const&)> const& piece_hashed
+	, std::atomic<bool>& skip)
+{
+	// If the file is smaller than one piece then the block hashes
+	// should be padded to the next power of two instead of the next
+	// piece boundary.
+	std::size_t const num_leafs = f.size < piece_size
+		? merkle_num_leafs(std::size_t((f.size + merkle_block_size - 1) / merkle_block_size))
+		: std::size_t(piece_size / merkle_block_size);
+
+	for (int p = j.first_piece; p < j.end_piece; ++p) {
+		if (skip) return false;
+		int const len = piece_bytes(f, piece_size, p);
+		char* const piece = buf + std::ptrdiff_t(p - j.first_piece) * piece_size;
+		{
+			stats::scoped_timer timer(stats::timer::sha256);
+			f.piece_layer[std::size_t(p)] = hash_piece({piece, len}, num_leafs, blocks);
+		}
+		if (f.v1) {
+			// the padding is hashed separately, since the data following the
+			// piece in the buffer may belong to the next file of a batch
+			stats::scoped_timer timer(stats::timer::sha1);
+			lt::hasher h(piece, len);
+			if (f.v1_pad) hash_zeros(h, piece_size - len);
+			f.v1_pieces[std::size_t(p)] = h.final();
+		}
+		if (progress) progress->bytes_done(len, f.device);
+		if (piece_hashed && !piece_hashed(j.file, p, f.piece_layer[std::size_t(p)])) {
+			skip = true;
+			return false;
+		}
+	}
+	return true;
+}
+
+inline void compute_root(file_hashes& f, int const piece_size)
+{
+	stats::scoped_timer timer(stats::timer::sha256);
+	if (f.piece_layer.size() == 1) {
+		f.root = f.piece_layer.front();
+		return;
+	}
+	f.root = merkle_root(f.piece_layer, merkle_num_leafs(f.piece_layer.size())
+		, merkle_depth(std::size_t(piece_size / merkle_block_size)));
+}
+
+} // namespace hash_detail
+
+// computes the v2 merkle roots and piece layers of all files, reading them from
+// disk. Large files are split up into multiple jobs, while files of a single
+// piece are read and hashed in batches of many files per job.
+//
+// Every device (see file_hashes::device) has its own queue of jobs, read by
+// opts.device_depth[device] threads. The data is handed to a pool of
+// "num_threads" hashing threads shared by all devices, so that all devices
+// can be read from at the same time, at their own pace. Within a device, files
+// are read in the order of their physical_offset.
+//
+// If "progress" is set, the bytes and files hashed are reported to it as they
+// complete. "piece_hashed" is called with the file index, piece index (within
+// the file) and hash of every piece as soon as it's hashed, concurrently from
+// all threads. If it returns false, the remaining pieces of that file are
+// skipped, and its root is not computed.
+inline void hash_files(lt::span<file_hashes> files, int const piece_size
+	, int const num_threads
+	, progress_reporter* progress = nullptr
+	, std::function<bool(std::size_t, int, lt::sha256_hash const&)> const& piece_hashed = {}
+	, read_options const& opts = {})
+{
+	using namespace hash_detail;
+
+	int const pieces_per_job = int(std::max(std::int64_t(1), opts.job_size / piece_size));
+	std::size_t const buffer_size = std::size_t(pieces_per_job) * std::size_t(piece_size);
+
+	// the jobs of each device, in the order they are read
+	std::vector<std::deque<job>> queues;
+	std::size_t num_jobs = 0;
+	// the number of outstanding jobs per file. The thread completing the last
+	// one computes the root of the file
+	std::unique_ptr<std::atomic<int>[]> outstanding(new std::atomic<int>[std::size_t(files.size())]);
+	// set for files whose remaining pieces should be skipped
+	std::unique_ptr<std::atomic<bool>[]> skip(new std::atomic<bool>[std::size_t(files.size())]);
+	std::vector<std::size_t> order(std::size_t(files.size()));
+	for (std::size_t i = 0; i < order.size(); ++i) order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](std::size_t const lhs, std::size_t const rhs) {
+		return files[std::ptrdiff_t(lhs)].physical_offset < files[std::ptrdiff_t(rhs)].physical_offset;
+	});
+	// files of a single piece are collected into batch jobs, per device, to
+	// not pay the overhead of a job per file. A batch is queued when it's full,
+	// or when a larger file comes along, to keep the order of the reads
+	std::vector<job> batches;
+	std::vector<std::size_t> batch_bytes;
+	auto flush_batch = [&](std::size_t const d) {
+		if (batches[d].batch.empty()) return;
+		queues[d].push_back(std::move(batches[d]));
+		batches[d] = job{};
+		batch_bytes[d] = 0;
+		++num_jobs;
+	};
+	for (std::size_t const i : order) {
+		auto& f = files[std::ptrdiff_t(i)];
+		int const num_pieces = int((f.size + piece_size - 1) / piece_size);
+		f.piece_layer.resize(std::size_t(num_pieces));
+		if (f.v1) f.v1_pieces.resize(std::size_t(num_pieces));
+		std::size_t const d = std::size_t(f.device);
+		if (d >= queues.size()) {
+			queues.resize(d + 1);
+			batches.resize(d + 1);
+			batch_bytes.resize(d + 1);
+		}
+		skip[i] = false;
+		if (num_pieces == 1) {
+			if (batch_bytes[d] + std::size_t(f.size) > buffer_size
+				|| batches[d].batch.size() >= max_batch_files)
+				flush_batch(d);
+			batches[d].batch.push_back(i);
+			batch_bytes[d] += std::size_t(f.size);
+			outstanding[i] = 1;
+			continue;
+		}
+		flush_batch(d);
+		int n = 0;
+		for (int p = 0; p < num_pieces; p += pieces_per_job) {
+			queues[d].push_back({i, p, std::min(num_pieces, p + pieces_per_job), {}});
+			++n;
+		}
+		num_jobs += std::size_t(n);
+		outstanding[i] = n;
+		if (n == 0) f.root.clear();
+	}
+	for (std::size_t d = 0; d < batches.size(); ++d) flush_batch(d);
+	if (num_jobs == 0) return;
+
+	// a job that has been read, and is waiting to be hashed. Jobs of skipped
+	// files are passed on without a buffer
+	struct read_job_t
+	{
+		job j;
+		std::unique_ptr<char[]> buf;
+	};
+
+	int const hashers = std::max(1, std::min(num_threads, int(num_jobs)));
+	std::vector<int> readers(queues.size());
+	int num_readers = 0;
+	for (std::size_t d = 0; d < queues.size(); ++d) {
+		int const depth = d < opts.device_depth.size()
+			? opts.device_depth[d]
+			: opts.device_depth.empty() ? num_threads : 1;
+		readers[d] = std::max(1, std::min(depth, int(queues[d].size())));
+		if (queues[d].empty()) readers[d] = 0;
+		num_readers += readers[d];
+	}
+
+	std::mutex mutex;
+	std::condition_variable buffer_freed;
+	std::condition_variable job_read;
+	// read buffers are allocated on demand, up to this many. Every reader and
+	// hasher can hold one at a time
+	int buffers_left = num_readers + hashers;
+	std::vector<std::unique_ptr<char[]>> free_buffers;
+	std::deque<read_job_t> ready;
+	int readers_running = num_readers;
+	bool abort = false;
+	std::exception_ptr error;
+
+	auto fail = [&] {
+		std::lock_guard<std::mutex> l(mutex);
+		if (!error) error = std::current_exception();
+		abort = true;
+		buffer_freed.notify_all();
+		job_read.notify_all();
+	};
+
+	auto reader = [&](std::size_t const device) {
+		input_file in;
+		output_file out;
+		std::size_t open_file = std::size_t(-1);
+		directory_cache dirs;
+		std::unique_lock<std::mutex> l(mutex);
+		try {
+			while (!abort && !queues[device].empty()) {
+				read_job_t r{std::move(queues[device].front()), {}};
+				queues[device].pop_front();
+				if (!r.j.batch.empty() || !skip[r.j.file]) {
+					buffer_freed.wait(l, [&] { return abort || !free_buffers.empty() || buffers_left > 0; });
+					if (abort) break;
+					if (!free_buffers.empty()) {
+						r.buf = std::move(free_buffers.back());
+						free_buffers.pop_back();
+					}
+					else {
+						--buffers_left;
+					}
+					l.unlock();
+					if (!r.buf) r.buf.reset(new char[buffer_size]);
+					if (!r.j.batch.empty()) {
+						read_batch(files, r.j, dirs, r.buf.get());
+					}
+					else {
+						auto const& f = files[std::ptrdiff_t(r.j.file)];
+						try {
+							read_job(files, r.j, piece_size, opts.readahead, in, out, open_file
+								, r.buf.get());
+						}
+						catch (std::exception const& e) {
+							throw std::runtime_error("failed to hash \"" + f.path + "\": " + e.what());
+						}
+					}
+					l.lock();
+				}
+				ready.push_back(std::move(r));
+				job_read.notify_one();
+			}
+			if (open_file != std::size_t(-1)) {
+				l.unlock();
+				close_copy(files[std::ptrdiff_t(open_file)], out);
+				l.lock();
+			}
+		}
+		catch (...) {
+			if (l.owns_lock()) l.unlock();
+			fail();
+			l.lock();
+		}
+		if (--readers_running == 0) job_read.notify_all();
+	};
+
+	auto hasher = [&] {
+		std::vector<lt::sha256_hash> blocks;
+		std::unique_lock<std::mutex> l(mutex);
+		try {
+			for (;;) {
+				job_read.wait(l, [&] { return abort || !ready.empty() || readers_running == 0; });
+				if (abort || ready.empty()) break;
+				read_job_t r = std::move(ready.front());
+				ready.pop_front();
+				l.unlock();
+
+				auto const job_done = [&](std::size_t const fi, bool const complete) {
+					if (--outstanding[fi] != 0) return;
+					if (complete && !skip[fi]) compute_root(files[std::ptrdiff_t(fi)], piece_size);
+					if (progress) progress->file_done();
+				};
+				if (!r.j.batch.empty()) {
+					char* buf = r.buf.get();
+					for (std::size_t const fi : r.j.batch) {
+						auto& f = files[std::ptrdiff_t(fi)];
+						job_done(fi, hash_job(f, {fi, 0, 1, {}}, piece_size, buf
+							, blocks, progress, piece_hashed, skip[fi]));
+						buf += f.size;
+					}
+				}
+				else {
+					std::size_t const fi = r.j.file;
+					job_done(fi, r.buf && hash_job(files[std::ptrdiff_t(fi)], r.j, piece_size
+						, r.buf.get(), blocks, progress, piece_hashed, skip[fi]));
+				}
+
+				l.lock();
+				if (r.buf) {
+					free_buffers.push_back(std::move(r.buf));
+					buffer_freed.notify_one();
+				}
+			}
+		}
+		catch (...) {
+			if (l.owns_lock()) l.unlock();
+			fail();
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (std::size_t d = 0; d < queues.size(); ++d)
+		for (int i = 0; i < readers[d]; ++i) pool.emplace_back(reader, d);
+	for (int i = 1; i < hashers; ++i) pool.emplace_back(hasher);
+	hasher();
+	for (auto& t : pool) t.join();
+
+	if (error) std::rethrow_exception(error);
+}
+
+// computes the v1 hashes of "pieces" of "fs", reading the files from
+// "save_path". Pad files are not read, they are hashed as zeros, and pieces
+// made up of pad files only are not hashed at all. The pieces are hashed by
+// "num_threads" threads, and "piece_hashed" is called with the index and hash
+// of every piece, concurrently from all threads. If "progress" is set, the
+// bytes read are reported to it, attributed to the device in "file_device"
+// (indexed by file), if any.
+inline void hash_v1_pieces(lt::file_storage const& fs, std::string const& save_path
+	, lt::span<lt::piece_index_t const> pieces, int const num_threads
+	, std::function<void(lt::piece_index_t, lt::sha1_hash const&)> const& piece_hashed
+	, progress_reporter* progress = nullptr
+	, lt::span<int const> file_device = {})
+{
+	using namespace hash_detail;
+
+	int const piece_size = fs.piece_length();
+	std::size_t const pieces_per_job = std::size_t(std::max(std::int64_t(1), job_size / piece_size));
+	std::size_t const num_pieces = std::size_t(pieces.size());
+
+	std::atomic<std::size_t> next_piece{0};
+	std::atomic<bool> abort{false};
+	std::mutex mutex;
+	std::exception_ptr error;
+
+	auto worker = [&] {
+		std::vector<char> buf(static_cast<std::size_t>(piece_size));
+		// consecutive pieces are likely to be in the same file, so keep it open
+		std::fstream in;
+		in.exceptions(std::ifstream::failbit);
+		lt::file_index_t open_file{-1};
+		std::string path;
+		try {
+			for (;;) {
+				std::size_t const first = next_piece.fetch_add(pieces_per_job);
+				if (first >= num_pieces || abort) break;
+				std::size_t const end = std::min(num_pieces, first + pieces_per_job);
+				for (std::size_t i = first; i < end; ++i) {
+					lt::piece_index_t const p = pieces[std::ptrdiff_t(i)];
+					auto const slices = fs.map_block(p, 0, fs.piece_size(p));
+					if (std::all_of(slices.begin(), slices.end()
+						, [&](lt::file_slice const& s) { return fs.pad_file_at(s.file_index); })) {
+						piece_hashed(p, zero_piece_hash(fs.piece_size(p)));
+						continue;
+					}
+					lt::hasher h;
+					for (auto const& slice : slices) {
+						if (fs.pad_file_at(slice.file_index)) {
+							stats::scoped_timer timer(stats::timer::sha1);
+							hash_zeros(h, slice.size);
+							continue;
+						}
+						try {
+							if (slice.file_index != open_file) {
+								open_file = lt::file_index_t{-1};
+								path = fs.file_path(slice.file_index, save_path);
+								if (in.is_open()) in.close();
+								in.open(path.c_str(), std::ios_base::in | std::ios_base::binary);
+								open_file = slice.file_index;
+								stats::add(stats::counter::files_opened, 1);
+							}
+							in.seekg(slice.offset, std::ios_base::beg);
+							stats::scoped_timer timer(stats::timer::read);
+							in.read(buf.data(), std::streamsize(slice.size));
+							stats::add(stats::counter::bytes_read, slice.size);
+						}
+						catch (std::exception const& e) {
+							throw std::runtime_error("failed to hash \"" + path + "\": " + e.what());
+						}
+						{
+							stats::scoped_timer timer(stats::timer::sha1);
+							h.update(buf.data(), int(slice.size));
+						}
+						if (progress) {
+							int const f = static_cast<int>(slice.file_index);
+							progress->bytes_done(slice.size
+								, f < file_device.size() ? file_device[f] : 0);
+						}
+					}
+					piece_hashed(p, h.final());
+				}
+			}
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> l(mutex);
+			if (!error) error = std::current_exception();
+			abort = true;
+		}
+	};
+
+	std::size_t const num_jobs = (num_pieces + pieces_per_job - 1) / pieces_per_job;
+	int const threads = std::max(1, std::min(num_threads, int(num_jobs)));
+	std::vector<std::thread> pool;
+	for (int i = 1; i < threads; ++i) pool.emplace_back(worker);
+	worker();
+	for (auto& t : pool) t.join();
+
+	if (error) std::rethrow_exception(error);
+}
@@ -0,0 +1,176 @@
+/*
+
+Copyright (c) 2026, Arvid Norberg
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#if defined _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// an open directory, to open the files in it relative to it with openat().
+// This saves the kernel from resolving the whole path for every file, which
+// matters when there are many small files in the same directory. The last
+// directory used is kept open.
+struct directory_cache
+{
+	directory_cache() = default;
+	directory_cache(directory_cache const&) = delete;
+	directory_cache& operator=(directory_cache const&) = delete;
+	~directory_cache() { close(); }
+
+	// returns a descriptor for directory "dir", valid until the next call, or
+	// -1 if it can't be opened
+	int get(std::string_view const dir)
+	{
+#if defined _WIN32
+		(void)dir;
+		return -1;
+#else
+		if (m_fd >= 0 && dir == m_dir) return m_fd;
+		close();
+		m_dir.assign(dir.data(), dir.size());
+		m_fd = ::open(m_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		return m_fd;
+#endif
+	}
+
+	void close()
+	{
+#if !defined _WIN32
+		if (m_fd >= 0) ::close(m_fd);
+		m_fd = -1;
+#endif
+	}
+
+private:
+	std::string m_dir;
+	int m_fd = -1;
+};
+
+// a file opened for reading at arbitrary offsets. On POSIX systems this reads
+// with pread(), and can tell the kernel how the file will be accessed, so it
+// can read ahead. Errors are reported as exceptions
+struct input_file
+{
+	input_file() = default;
+	input_file(input_file const&) = delete;
+	input_file& operator=(input_file const&) = delete;
+	~input_file() { close(); }
+
+	void open(std::string const& path)
+	{
+		close();
+#if defined _WIN32
+		m_file.exceptions(std::ifstream::failbit);
+		m_file.open(path.c_str(), std::ios_base::in | std::ios_base::binary);
+#else
+		m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (m_fd < 0) throw std::system_error(errno, std::generic_category());
+#endif
+	}
+
+	// opens "path" relative to its directory, as cached by "dirs"
+	void open(std::string const& path, directory_cache& dirs)
+	{
+#if defined _WIN32
+		(void)dirs;
+		open(path);
+#else
+		auto const slash = path.find_last_of('/');
+		int const dir = slash == std::string::npos
+			? -1 : dirs.get(std::string_view(path).substr(0, slash + 1));
+		if (dir < 0) {
+			// let open() report the error, if any
+			open(path);
+			return;
+		}
+		close();
+		m_fd = ::openat(dir, path.c_str() + slash + 1, O_RDONLY | O_CLOEXEC);
+		if (m_fd < 0) throw std::system_error(errno, std::generic_category());
+#endif
+	}
+
+	bool is_open() const
+	{
+#if defined _WIN32
+		return m_file.is_open();
+#else
+		return m_fd >= 0;
+#endif
+	}
+
+	void close()
+	{
+#if defined _WIN32
+		if (m_file.is_open()) m_file.close();
+#else
+		if (m_fd >= 0) ::close(m_fd);
+		m_fd = -1;
+#endif
+	}
+
+	// reads exactly "len" bytes at "offset"
+	void read(std::int64_t offset, char* buf, std::int64_t len)
+	{
+#if defined _WIN32
+		m_file.seekg(offset, std::ios_base::beg);
+		m_file.read(buf, std::streamsize(len));
+#else
+		while (len > 0) {
+			ssize_t const ret = ::pread(m_fd, buf, std::size_t(len), off_t(offset));
+			if (ret < 0) {
+				if (errno == EINTR) continue;
+				throw std::system_error(errno, std::generic_category());
+			}
+			if (ret == 0) throw std::runtime_error("unexpected end of file");
+			buf += ret;
+			offset += ret;
+			len -= ret;
+		}
+#endif
+	}
+
+	// hints that the file will be read from start to end, which lets the
+	// kernel read further ahead
+	void sequential()
+	{
+#if defined POSIX_FADV_SEQUENTIAL
+		::posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	}
+
+	// hints that the range will be read soon, to have the kernel start
+	// reading it in the background
+	void will_need(std::int64_t const offset, std::int64_t const len)
+	{
+#if defined POSIX_FADV_WILLNEED
+		::posix_fadvise(m_fd, off_t(offset), off_t(len), POSIX_FADV_WILLNEED);
+#else
+		(void)offset;
+		(void)len;
+#endif
+	}
+
+private:
+#if defined _WIN32
+	std::fstream m_file;
+#else
+	int m_fd = -1;
+#endif
+};
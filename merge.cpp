@@ -13,10 +13,17 @@ see LICENSE file.
 #include "libtorrent/torrent_info.hpp"
 
 #include "common.hpp"
+#include "merkle.hpp"
+#include "pad_hash.hpp"
+#include "sidecar.hpp"
+#include "stats.hpp"
 
 #include <ctime>
 #include <unordered_map>
 #include <set>
+#include <algorithm>
+#include <fstream>
+#include <memory>
 #include <iostream>
 #include <string_view>
 #include <stdexcept>
@@ -33,6 +40,20 @@ OPTIONS:
                           If not specified "a.torrent" is used.
 -n, --name <name>         Set the name of the new torrent. If not specified,
                           the name of the first torrent will be used
+--hybrid                  Create a hybrid (v1 + v2) torrent. The v1 piece hashes
+                          are carried over from the input torrents. Pieces that
+                          cannot be carried over (because the input is v2-only,
+                          has a different piece size or the padding of the last
+                          piece changes) are hashed from --data-dir
+--data-dir <path>         The directory the content of the input torrents is
+                          saved in. Only used by --hybrid
+--sidecar                 Also write the file roots and piece layers to
+                          <out>.sidecar (see torrent-new --sidecar)
+--use-sidecars            Take the piece layers of each input torrent from its
+                          sidecar (<file>.sidecar) instead of parsing them.
+                          They are still checked against the file roots
+--stats[=json]            Print where time was spent (parsing, reading,
+                          hashing, writing etc.) to stderr on exit
 -h, --help                Show this message
 -q                        Quiet, do not print log messages
 
@@ -40,7 +61,7 @@ Reads the torrent files, specified by "files..." and creates a new torrent
 containing all files in all torrents. Any file found in more than one torrent
 will only be included once in the output.
 
-Only BitTorrent v2 torrent files are supported.
+Only BitTorrent v2 and hybrid torrent files are supported.
 )";
 }
 
@@ -76,33 +97,53 @@ struct file_metadata
 	// the piece hashes for this file
 	// note that small files don't have a piece layer
 	std::vector<lt::sha256_hash> piece_layer;
+
+	// the path of the file in the torrent it was loaded from. This is used to
+	// find it under --data-dir, in case it needs to be hashed
+	std::string source_path;
+
+	// the v1 piece hashes for this file, from the source torrent. This is
+	// empty if the source torrent did not have v1 hashes or if the file was
+	// not piece aligned.
+	std::vector<lt::sha1_hash> v1_pieces;
+
+	// true if the last v1 piece of this file was padded with zeros up to the
+	// piece boundary in the source torrent. This is the case for all files
+	// except the last one.
+	bool v1_padded;
 };
 
-lt::sha256_hash merkle_pad(int blocks, int pieces)
+// hash the v1 pieces [first_piece, end_piece) of the specified file. If pad is
+// true, the last piece is padded with zeros up to the piece size.
+std::vector<lt::sha1_hash> hash_v1_pieces(std::string const& path
+	, std::int64_t const file_size, int const piece_size
+	, int const first_piece, int const end_piece, bool const pad)
 {
-	TORRENT_ASSERT(blocks >= pieces);
-	lt::sha256_hash ret{};
-	while (pieces < blocks)
-	{
-		lt::hasher256 h;
-		h.update(ret);
-		h.update(ret);
-		ret = h.final();
-		pieces *= 2;
+	std::fstream in;
+	in.exceptions(std::ifstream::failbit);
+	in.open(path.c_str(), std::ios_base::in | std::ios_base::binary);
+	in.seekg(std::int64_t(first_piece) * piece_size, std::ios_base::beg);
+	stats::add(stats::counter::files_opened, 1);
+
+	std::vector<char> buf(std::size_t(piece_size), 0);
+	std::vector<lt::sha1_hash> ret;
+	ret.reserve(std::size_t(end_piece - first_piece));
+	for (int p = first_piece; p < end_piece; ++p) {
+		std::int64_t const offset = std::int64_t(p) * piece_size;
+		int const len = int(std::min(std::int64_t(piece_size), file_size - offset));
+		{
+			stats::scoped_timer timer(stats::timer::read);
+			in.read(buf.data(), len);
+		}
+		stats::add(stats::counter::bytes_read, len);
+		stats::scoped_timer timer(stats::timer::sha1);
+		lt::hasher h(buf.data(), len);
+		if (pad) hash_zeros(h, piece_size - len);
+		ret.push_back(h.final());
 	}
 	return ret;
 }
 
-std::size_t merkle_num_leafs(std::size_t const blocks)
-{
-	TORRENT_ASSERT(blocks > 0);
-	TORRENT_ASSERT(blocks <= std::numeric_limits<std::size_t>::max() / 2);
-	// round up to nearest 2 exponent
-	std::size_t ret = 1;
-	while (blocks > ret) ret <<= 1;
-	return ret;
-}
-
 } // anonymous namespace
 
 int main(int argc_, char const* argv_[]) try
@@ -120,6 +161,10 @@ int main(int argc_, char const* argv_[]) try
 	std::time_t creation_date = 0;
 	bool private_torrent = false;
 	bool quiet = false;
+	bool hybrid = false;
+	std::string data_dir;
+	bool sidecar_out = false;
+	bool use_sidecars = false;
 	std::set<std::string> web_seeds;
 	std::set<std::pair<std::string, int>> dht_nodes;
 
@@ -147,6 +192,21 @@ int main(int argc_, char const* argv_[]) try
 			name = args[1];
 			args = args.subspan(1);
 		}
+		else if (args[0] == "--hybrid"sv) {
+			hybrid = true;
+		}
+		else if (args[0] == "--sidecar"sv) {
+			sidecar_out = true;
+		}
+		else if (args[0] == "--use-sidecars"sv) {
+			use_sidecars = true;
+		}
+		else if (args[0] == "--data-dir"sv && args.size() > 1) {
+			data_dir = args[1];
+			args = args.subspan(1);
+		}
+		else if (stats::parse_option(args[0])) {
+		}
 		else {
 			std::cerr << "unknown option " << args[0] << '\n';
 			print_usage();
@@ -162,7 +222,18 @@ int main(int argc_, char const* argv_[]) try
 	for (auto const filename : args) {
 
 		if (!quiet) std::cout << "-> " << filename << "\n";
-		lt::torrent_info t{std::string(filename)};
+		lt::torrent_info const t = [&] {
+			stats::scoped_timer timer(stats::timer::parse);
+			if (use_sidecars)
+				return load_torrent_without_layers(filename, lt::load_torrent_limits{});
+			return lt::torrent_info{std::string(filename)};
+		}();
+		std::unique_ptr<sidecar const> side;
+		if (use_sidecars) {
+			side = std::make_unique<sidecar const>(std::string(filename) + ".sidecar");
+			side->check(t);
+			side->check_layers(t);
+		}
 		lt::file_storage const& fs = t.files();
 
 		if (name.empty()) name = fs.name();
@@ -215,14 +286,37 @@ int main(int argc_, char const* argv_[]) try
 
 			max_piece_size = std::max(t.piece_length(), max_piece_size);
 
-			auto const piece_layer = t.piece_layer(i);
+			auto const piece_layer = side ? side->piece_layer(i) : t.piece_layer(i);
+
+			int const piece_size = t.piece_length();
+			std::int64_t const file_offset = fs.file_offset(i);
+			std::int64_t const file_end = file_offset + fs.file_size(i);
+			lt::file_index_t const next(static_cast<int>(i) + 1);
+			bool const padded = next < fs.end_file()
+				&& (fs.pad_file_at(next) || file_end % piece_size == 0);
+
+			// the v1 hashes can only be carried over if the file is aligned to
+			// pieces, otherwise the pieces contain data from other files.
+			std::vector<lt::sha1_hash> v1_pieces;
+			if (hybrid && t.info_hashes().has_v1()
+				&& file_offset % piece_size == 0
+				&& (padded || next == fs.end_file()))
+			{
+				lt::piece_index_t const end_piece(
+					int((file_end + piece_size - 1) / piece_size));
+				for (lt::piece_index_t p(int(file_offset / piece_size)); p < end_piece; ++p)
+					v1_pieces.push_back(t.hash_for_piece(p));
+			}
 
 			file_metadata meta{std::string(fs.file_name(i))
-				, t.piece_length()
+				, piece_size
 				, fs.file_size(i)
 				, fs.mtime(i)
 				, fs.file_flags(i)
-				, make_piece_layer(piece_layer)};
+				, make_piece_layer(piece_layer)
+				, fs.file_path(i)
+				, std::move(v1_pieces)
+				, padded};
 			files[root] = std::move(meta);
 
 			if (!quiet) std::cout << "  " << root << ' ' << fs.file_size(i) << ' ' << fs.file_name(i) << '\n';
@@ -318,6 +412,78 @@ int main(int argc_, char const* argv_[]) try
 		}
 	}
 
+	if (hybrid) {
+		// the v1 file list must be in the same order as the v2 file tree,
+		// i.e. sorted by name. Every file, except the last one, is followed by
+		// a pad file to align the next file to a piece boundary
+		std::vector<file_metadata const*> order;
+		order.reserve(files.size());
+		for (auto const& f : files) order.push_back(&f.second);
+		std::sort(order.begin(), order.end()
+			, [](file_metadata const* lhs, file_metadata const* rhs)
+			{ return lhs->filename < rhs->filename; });
+
+		auto& files_list = info_out["files"].list();
+		std::string& pieces = info_out["pieces"].string();
+
+		for (std::size_t k = 0; k < order.size(); ++k) {
+			file_metadata const& f = *order[k];
+			bool const pad = k + 1 < order.size();
+			int const num_pieces = int((f.file_size + max_piece_size - 1) / max_piece_size);
+
+			// the number of pieces we can carry over from the source torrent.
+			// The last piece can only be carried over if its padding is
+			// unchanged
+			int carry = 0;
+			if (f.piece_size == max_piece_size && int(f.v1_pieces.size()) == num_pieces) {
+				carry = num_pieces;
+				if (num_pieces > 0 && f.file_size % max_piece_size != 0 && pad != f.v1_padded)
+					--carry;
+			}
+
+			for (int p = 0; p < carry; ++p)
+				pieces.append(f.v1_pieces[std::size_t(p)].data(), lt::sha1_hash::size());
+
+			if (carry < num_pieces) {
+				if (data_dir.empty()) {
+					throw std::runtime_error("the v1 hashes of \"" + f.source_path
+						+ "\" cannot be carried over, specify --data-dir to hash it");
+				}
+#ifdef TORRENT_WINDOWS
+				std::string const path = data_dir + '\\' + f.source_path;
+#else
+				std::string const path = data_dir + '/' + f.source_path;
+#endif
+				if (!quiet) std::cout << "hashing " << (num_pieces - carry) << " piece(s) of " << path << '\n';
+				for (auto const& h : hash_v1_pieces(path, f.file_size, max_piece_size, carry, num_pieces, pad))
+					pieces.append(h.data(), lt::sha1_hash::size());
+			}
+
+			auto& file_e = files_list.emplace_back();
+			file_e["length"] = f.file_size;
+			file_e["path"].list().emplace_back(f.filename);
+			if (f.mtime != 0) {
+				file_e["mtime"] = f.mtime;
+			}
+			if (f.file_flags & lt::file_storage::flag_executable)
+				file_e["attr"].string() += 'x';
+
+			if (f.file_flags & lt::file_storage::flag_hidden)
+				file_e["attr"].string() += 'h';
+
+			std::int64_t const tail = f.file_size % max_piece_size;
+			if (pad && tail != 0) {
+				std::int64_t const pad_size = max_piece_size - tail;
+				auto& pad_e = files_list.emplace_back();
+				pad_e["length"] = pad_size;
+				pad_e["attr"] = "p";
+				auto& pad_path = pad_e["path"].list();
+				pad_path.emplace_back(".pad");
+				pad_path.emplace_back(std::to_string(pad_size));
+			}
+		}
+	}
+
 	auto& file_tree = info_out["file tree"];
 
 	for (auto& [root, f] : files) {
@@ -334,27 +500,13 @@ int main(int argc_, char const* argv_[]) try
 			entry["attr"].string() += 'h';
 
 		if (f.piece_size != max_piece_size) {
+			stats::scoped_timer timer(stats::timer::sha256);
 			// in this case we need to combine some of the piece layer hashes to
 			// raise them up to a higher level in the merkle tree
-			lt::sha256_hash pad = merkle_pad(f.piece_size / 0x4000, 1);
-
-			f.piece_layer.resize(merkle_num_leafs(f.piece_layer.size()), pad);
-
-			while (f.piece_size < max_piece_size) {
-				// reduce the piece layer by one level
-				for (std::size_t i = 0; i < f.piece_layer.size(); i += 2) {
-					auto const left = f.piece_layer[i];
-					auto const right = f.piece_layer[i + 1];
-					f.piece_layer[i / 2] = lt::hasher256().update(left).update(right).final();
-				}
-				pad = lt::hasher256().update(pad).update(pad).final();
-				f.piece_layer.resize(f.piece_layer.size() / 2);
-				f.piece_size *= 2;
-			}
-
-			// remove any remaining padding at the end
-			while (!f.piece_layer.empty() && f.piece_layer.back() == pad)
-				f.piece_layer.resize(f.piece_layer.size() - 1);
+			merkle_raise_layer(f.piece_layer
+				, merkle_depth(std::size_t(f.piece_size / merkle_block_size))
+				, merkle_depth(std::size_t(max_piece_size / merkle_block_size)));
+			f.piece_size = max_piece_size;
 		}
 
 		// not all files have piece lyers. Files that are just a single block
@@ -370,16 +522,25 @@ int main(int argc_, char const* argv_[]) try
 	}
 
 	std::vector<char> torrent;
-	lt::bencode(back_inserter(torrent), torrent_e);
+	{
+		stats::scoped_timer timer(stats::timer::encode);
+		lt::bencode(back_inserter(torrent), torrent_e);
+	}
+	if (!quiet) std::cout << "-> writing to " << output_file << "\n";
+
+	stats::scoped_timer timer(stats::timer::write);
 	std::fstream out;
 	out.exceptions(std::ifstream::failbit);
 	out.open(output_file.c_str(), std::ios_base::out | std::ios_base::binary);
-
-	if (!quiet) std::cout << "-> writing to " << output_file << "\n";
 	out.write(torrent.data(), int(torrent.size()));
+	stats::add(stats::counter::bytes_written, std::int64_t(torrent.size()));
+	timer.stop();
+
+	if (sidecar_out) save_sidecar(output_file + ".sidecar", torrent);
 }
 catch (std::exception const& e)
 {
 	std::cerr << "failed: " << e.what() << '\n';
+	return 1;
 }
 
@@ -0,0 +1,220 @@
+/*
+
+Copyright (c) 2026, Arvid Norberg
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#pragma once
+
+#include "libtorrent/sha1_hash.hpp" // for sha256_hash
+#include "libtorrent/hasher.hpp"
+#include "libtorrent/span.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+// the size of the leaves in the v2 merkle trees
+int const merkle_block_size = 0x4000;
+
+// the number of levels above the leaves of a tree with "num_leafs" leaves,
+// rounded up to a whole tree
+inline int merkle_depth(std::size_t num_leafs)
+{
+	int ret = 0;
+	while (num_leafs > 1) {
+		num_leafs = (num_leafs + 1) / 2;
+		++ret;
+	}
+	return ret;
+}
+
+// returns the root of a subtree of zero blocks, "level" levels high (i.e. with
+// 2^level blocks). All levels that can occur are computed once, on first use,
+// instead of hashing the chain of pad hashes every time it's needed
+inline lt::sha256_hash const& merkle_zero_hash(int const level)
+{
+	struct table
+	{
+		// a tree can't have more leaves than fit in a size_t
+		std::array<lt::sha256_hash, std::numeric_limits<std::size_t>::digits> hashes;
+
+		table()
+		{
+			for (std::size_t i = 1; i < hashes.size(); ++i)
+				hashes[i] = lt::hasher256().update(hashes[i - 1]).update(hashes[i - 1]).final();
+		}
+	};
+	static table const t;
+	TORRENT_ASSERT(level >= 0 && std::size_t(level) < t.hashes.size());
+	return t.hashes[std::size_t(level)];
+}
+
+inline std::size_t merkle_num_leafs(std::size_t const blocks)
+{
+	TORRENT_ASSERT(blocks > 0);
+	TORRENT_ASSERT(blocks <= std::numeric_limits<std::size_t>::max() / 2);
+	// round up to nearest 2 exponent
+	std::size_t ret = 1;
+	while (blocks > ret) ret <<= 1;
+	return ret;
+}
+
+inline lt::sha256_hash merkle_hash_pair(lt::sha256_hash const& left
+	, lt::sha256_hash const& right)
+{
+	return lt::hasher256().update(left).update(right).final();
+}
+
+// computes the root of a tree from its leaves, as they are streamed in, left
+// to right. Only the roots of the complete subtrees seen so far are kept (one
+// per level), so the leaves never need to be held in memory all at once
+struct merkle_builder
+{
+	// each leaf is the root of a subtree "pad_level" levels high (0 for block
+	// hashes)
+	explicit merkle_builder(int const pad_level = 0) : m_pad_level(pad_level) {}
+
+	void add(lt::sha256_hash h)
+	{
+		int level = 0;
+		// like incrementing a binary counter, every set bit is a complete
+		// subtree to merge with
+		while (m_count & (std::size_t(1) << level)) {
+			h = merkle_hash_pair(m_subtrees[std::size_t(level)], h);
+			++level;
+		}
+		m_subtrees[std::size_t(level)] = h;
+		++m_count;
+	}
+
+	std::size_t size() const { return m_count; }
+
+	// the root of a tree with "num_leafs" leaves (a power of 2, no fewer than
+	// the leaves added), where the remaining leaves are padding
+	lt::sha256_hash root(std::size_t const num_leafs) const
+	{
+		TORRENT_ASSERT(m_count <= num_leafs);
+		int const depth = merkle_depth(num_leafs);
+		if (m_count == num_leafs) return m_subtrees[std::size_t(depth)];
+		// fold the complete subtrees into the right-most, partial, one, from
+		// the bottom up. Until there is one, it's all padding
+		bool partial = false;
+		lt::sha256_hash h;
+		for (int level = 0; level < depth; ++level) {
+			if (m_count & (std::size_t(1) << level)) {
+				h = merkle_hash_pair(m_subtrees[std::size_t(level)]
+					, partial ? h : merkle_zero_hash(m_pad_level + level));
+				partial = true;
+			}
+			else if (partial) {
+				h = merkle_hash_pair(h, merkle_zero_hash(m_pad_level + level));
+			}
+		}
+		return partial ? h : merkle_zero_hash(m_pad_level + depth);
+	}
+
+private:
+	std::array<lt::sha256_hash, std::numeric_limits<std::size_t>::digits> m_subtrees;
+	std::size_t m_count = 0;
+	int const m_pad_level;
+};
+
+// computes the root of a tree with "num_leafs" leaves (which must be a power
+// of 2), where the first leaves are "leafs" and the remaining ones are
+// padding. Each leaf is the root of a subtree "pad_level" levels high (0 for
+// block hashes), so the padding is merkle_zero_hash(pad_level)
+inline lt::sha256_hash merkle_root(lt::span<lt::sha256_hash const> leafs
+	, std::size_t const num_leafs, int const pad_level = 0)
+{
+	TORRENT_ASSERT(std::size_t(leafs.size()) <= num_leafs);
+	merkle_builder b(pad_level);
+	for (auto const& h : leafs) b.add(h);
+	return b.root(num_leafs);
+}
+
+// replaces "layer", whose hashes are roots of subtrees "from_level" levels
+// high, with the layer "to_level" levels high. This is how a piece layer is
+// raised to a larger piece size. Only the last subtree of every level is
+// padded, no padding is added to the end of the layer. Once the layer is down
+// to a single hash, it's the root of the tree, and is left as is
+inline void merkle_raise_layer(std::vector<lt::sha256_hash>& layer, int from_level
+	, int const to_level)
+{
+	TORRENT_ASSERT(from_level <= to_level);
+	for (; from_level < to_level && layer.size() > 1; ++from_level) {
+		if (layer.size() % 2) layer.push_back(merkle_zero_hash(from_level));
+		for (std::size_t i = 0; i < layer.size(); i += 2)
+			layer[i / 2] = merkle_hash_pair(layer[i], layer[i + 1]);
+		layer.resize(layer.size() / 2);
+	}
+}
+
+// a complete tree, stored as a flat array in level order (the same layout as
+// libtorrent uses): the root first, then every level left to right, ending
+// with the leaves. Node i has its children at 2i + 1 and 2i + 2.
+struct merkle_tree
+{
+	// builds the tree of "num_leafs" leaves (a power of 2), where the first
+	// ones are "leafs" and the remaining ones are padding, like merkle_root().
+	// Every level is hashed in one pass over a contiguous range
+	merkle_tree(lt::span<lt::sha256_hash const> leafs, std::size_t const num_leafs
+		, int const pad_level = 0)
+		: m_nodes(num_leafs * 2 - 1)
+		, m_num_leafs(num_leafs)
+	{
+		TORRENT_ASSERT(std::size_t(leafs.size()) <= num_leafs);
+		std::size_t first = num_leafs - 1;
+		std::copy(leafs.begin(), leafs.end(), m_nodes.begin() + std::ptrdiff_t(first));
+		std::fill(m_nodes.begin() + std::ptrdiff_t(first) + leafs.size(), m_nodes.end()
+			, merkle_zero_hash(pad_level));
+		for (std::size_t width = num_leafs / 2; width > 0; width /= 2) {
+			std::size_t const parent = first - width;
+			for (std::size_t i = 0; i < width; ++i) {
+				m_nodes[parent + i] = merkle_hash_pair(m_nodes[first + i * 2]
+					, m_nodes[first + i * 2 + 1]);
+			}
+			first = parent;
+		}
+	}
+
+	lt::sha256_hash const& root() const { return m_nodes.front(); }
+
+	lt::span<lt::sha256_hash const> leafs() const
+	{
+		return {m_nodes.data() + m_num_leafs - 1, std::ptrdiff_t(m_num_leafs)};
+	}
+
+	// the hashes needed to verify leaf "leaf" against the root (its uncle
+	// hashes), from the bottom up. See merkle_verify_proof()
+	std::vector<lt::sha256_hash> proof(std::size_t const leaf) const
+	{
+		TORRENT_ASSERT(leaf < m_num_leafs);
+		std::vector<lt::sha256_hash> ret;
+		for (std::size_t i = m_num_leafs - 1 + leaf; i > 0; i = (i - 1) / 2)
+			ret.push_back(m_nodes[i % 2 ? i + 1 : i - 1]);
+		return ret;
+	}
+
+private:
+	std::vector<lt::sha256_hash> m_nodes;
+	std::size_t m_num_leafs;
+};
+
+// returns true if "leaf", at index "index" among the leaves, hashes up to
+// "root" with the uncle hashes "proof" (bottom up, as returned by
+// merkle_tree::proof())
+inline bool merkle_verify_proof(lt::sha256_hash h, std::size_t index
+	, lt::span<lt::sha256_hash const> proof, lt::sha256_hash const& root)
+{
+	for (auto const& uncle : proof) {
+		h = index % 2 ? merkle_hash_pair(uncle, h) : merkle_hash_pair(h, uncle);
+		index /= 2;
+	}
+	return h == root;
+}
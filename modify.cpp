@@ -13,13 +13,28 @@ see LICENSE file.
 #include "libtorrent/create_torrent.hpp"
 
 #include "common.hpp"
+#include "splice.hpp"
+#include "file_matcher.hpp"
+#include "restructure.hpp"
+#include "sidecar.hpp"
+#include "stats.hpp"
 
 #include <functional>
 #include <cstdio>
 #include <sstream>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <regex>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <optional>
 #include <set>
+#include <unordered_map>
 
 #ifdef TORRENT_WINDOWS
 #include <direct.h> // for _getcwd
@@ -33,9 +48,13 @@ namespace {
 
 using namespace std::placeholders;
 
+int const default_num_threads
+	= std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
 void print_usage()
 {
 	std::cerr << R"(USAGE: torrent-modify [OPTIONS] file
+       torrent-modify [OPTIONS] (--in-place | --out-dir <dir>) files...
 
 Loads the specified torrent file, modifies it according to the specified options
 and writes it to an output .torrent file (as specified by -o)
@@ -44,6 +63,16 @@ OPTIONS:
 -o, --out <file>          Print resulting torrent to the specified file.
                           If not specified "a.torrent" is used.
 
+bulk mode:
+
+--in-place                    Modify all specified torrent files, replacing them
+                              with the modified versions.
+--out-dir <dir>               Modify all specified torrent files, writing the
+                              modified versions to <dir>, keeping their file names.
+                              Inputs with the same file name are rejected.
+--threads <n>                 Use <n> threads to modify torrents in bulk mode.
+                              Defaults to )" << default_num_threads << R"(.
+
 adding fields:
 
 -n, --name <name>             Change name of the torrent to the specified one. This
@@ -75,10 +104,46 @@ Removing fields:
 --drop-creation-date          Remove creation date field
 --drop-root-cert              Remove the root certificate.
 
-Removing files:
+Removing and renaming files:
 
 --drop-file <name>            Remove all files whose name exactly matches <name>
-
+--drop <pattern>              Remove all files matching the glob <pattern>. If
+                              it contains a "/" it's matched against the full
+                              path (starting with the torrent name), otherwise
+                              against the file name. "*" and "?" don't match
+                              "/", "**" does. [abc] and [!abc] match character
+                              classes.
+--drop-regex <regex>          Remove all files whose full path matches <regex>
+--drop-smaller <size>         Remove all files smaller than <size> bytes
+--drop-larger <size>          Remove all files larger than <size> bytes. Sizes
+                              may have a k, m or g suffix.
+--drop-attr <attributes>      Remove all files with all of the specified
+                              attributes. x = executable, h = hidden,
+                              l = symlink.
+--data-dir <dir>              The directory the torrent's files are stored in
+                              (i.e. the save path). When dropping files from a
+                              torrent whose files are not piece-aligned (e.g.
+                              v1-only torrents), the pieces straddling the
+                              dropped files need to be hashed again, reading
+                              data from here.
+--rename-file <name> <new>    Rename all files whose name exactly matches <name>
+                              to <new>
+--rename <pattern> <new>      Rename all files matching the glob <pattern> to
+                              <new> (same syntax as --drop)
+--rename-regex <regex> <fmt>  Replace the part of the full path matching <regex>
+                              with <fmt>, where $1 refers to the first capture
+                              group, and so on.
+
+The drop and rename rules are compiled into one matcher up-front, and all files
+are matched against it in a single pass. If more than one rename rule matches a
+file, the first one is used.
+
+--sidecar                     Also write the file roots and piece layers of
+                              each output torrent to <out>.sidecar (see
+                              torrent-new --sidecar). Only v2 and hybrid
+                              torrents have sidecars.
+--stats[=json]                Print where time was spent (parsing, reading,
+                              hashing, writing etc.) to stderr on exit
 -h, --help                    Show this message
 
 TRACKER TIERS
@@ -94,30 +159,88 @@ Will add foo and bar as separate tiers.
   -t https://foo.com -T https://bar.com
 
 Will add foo and bar as the same tier.
+
+If only fields outside of the info dictionary are modified (trackers, web seeds,
+DHT nodes, comment, creator and creation date), the info dictionary is copied
+verbatim from the input, without being re-generated. This is a lot cheaper and
+preserves the info-hash.
 )";
 }
 
-struct file_metadata
+lt::file_flags_t parse_attributes(char const* str)
 {
-	lt::index_range<lt::piece_index_t> pieces;
-	lt::span<char const> piece_layer;
-	char const* root_hash;
-	lt::file_index_t idx;
-};
+	lt::file_flags_t ret{};
+	for (; *str != '\0'; ++str) {
+		switch (*str) {
+			case 'x': ret |= lt::file_storage::flag_executable; break;
+			case 'h': ret |= lt::file_storage::flag_hidden; break;
+			case 'l': ret |= lt::file_storage::flag_symlink; break;
+			default:
+				throw std::runtime_error("invalid file attribute: " + std::string(1, *str));
+		}
+	}
+	return ret;
+}
 
-} // anonymous namespace
+// returns the trackers of the torrent, one vector per tier
+std::vector<std::vector<std::string>> load_trackers(lt::bdecode_node const& torrent)
+{
+	std::vector<std::vector<std::string>> ret;
+	if (auto const al = torrent.dict_find_list("announce-list")) {
+		for (int i = 0; i < al.list_size(); ++i) {
+			auto const tier = al.list_at(i);
+			if (tier.type() != lt::bdecode_node::list_t) continue;
+			auto& t = ret.emplace_back();
+			for (int k = 0; k < tier.list_size(); ++k) {
+				auto const url = tier.list_at(k);
+				if (url.type() != lt::bdecode_node::string_t) continue;
+				t.emplace_back(url.string_value());
+			}
+		}
+	}
+	if (ret.empty()) {
+		auto const url = torrent.dict_find_string_value("announce");
+		if (!url.empty()) ret.push_back({std::string(url)});
+	}
+	return ret;
+}
 
-int main(int argc_, char const* argv_[]) try
+std::vector<std::string> load_web_seeds(lt::bdecode_node const& torrent)
 {
-	lt::span<char const*> args(argv_, argc_);
-	// strip executable name
-	args = args.subspan(1);
+	std::vector<std::string> ret;
+	auto const url_list = torrent.dict_find("url-list");
+	if (url_list.type() == lt::bdecode_node::string_t) {
+		ret.emplace_back(url_list.string_value());
+	}
+	else if (url_list.type() == lt::bdecode_node::list_t) {
+		for (int i = 0; i < url_list.list_size(); ++i) {
+			auto const url = url_list.list_at(i);
+			if (url.type() != lt::bdecode_node::string_t) continue;
+			ret.emplace_back(url.string_value());
+		}
+	}
+	return ret;
+}
 
-	if (args.size() < 2) {
-		print_usage();
-		return 1;
+std::vector<std::pair<std::string, int>> load_nodes(lt::bdecode_node const& torrent)
+{
+	std::vector<std::pair<std::string, int>> ret;
+	auto const nodes = torrent.dict_find_list("nodes");
+	if (!nodes) return ret;
+	for (int i = 0; i < nodes.list_size(); ++i) {
+		auto const n = nodes.list_at(i);
+		if (n.type() != lt::bdecode_node::list_t
+			|| n.list_size() < 2
+			|| n.list_at(0).type() != lt::bdecode_node::string_t
+			|| n.list_at(1).type() != lt::bdecode_node::int_t)
+			continue;
+		ret.emplace_back(n.list_at(0).string_value(), int(n.list_at(1).int_value()));
 	}
+	return ret;
+}
 
+struct modify_options
+{
 	std::string creator;
 	std::string name;
 	std::string comment_str;
@@ -129,8 +252,16 @@ int main(int argc_, char const* argv_[]) try
 	lt::create_flags_t flags = {};
 	std::string root_cert;
 	bool quiet = false;
-	std::set<std::string> drop_file;
-	std::map<std::string, std::string> rename_file;
+	std::string data_dir;
+
+	// files matching any of these rules are removed
+	file_matcher drop_file;
+
+	// files matching any of these rules are renamed. rename_to is indexed by
+	// the rule. For regex rules it's the replacement for the matching part of
+	// the path, for other rules it's the new file name
+	file_matcher rename_file;
+	std::vector<std::string> rename_to;
 
 	bool drop_trackers = false;
 	bool drop_mtime = false;
@@ -141,6 +272,470 @@ int main(int argc_, char const* argv_[]) try
 	bool drop_creation_date = false;
 	bool drop_root_cert = false;
 
+	// write <output>.sidecar next to every output torrent
+	bool sidecar = false;
+
+	// bulk mode. Either overwrite the input files, or write the output files
+	// to out_dir
+	bool in_place = false;
+	std::string out_dir;
+	int num_threads = default_num_threads;
+};
+
+// applies the modifications in "opts" to the torrent "input_buf" and returns
+// the resulting bencoded torrent. In bulk mode, "opts" (and its compiled file
+// matchers) is shared by all torrents. Only the lists of trackers, web seeds
+// and DHT nodes, which are extended by the ones from the input, are copied
+std::vector<char> modify_torrent(modify_options const& opts, std::vector<char> const& input_buf)
+{
+	{
+		lt::bdecode_node const torrent = [&] {
+			stats::scoped_timer timer(stats::timer::parse);
+			return lt::bdecode(input_buf);
+		}();
+		lt::bdecode_node const info = torrent.dict_find_dict("info");
+		if (!info) throw std::runtime_error("invalid torrent file, missing info dictionary");
+
+		bool const priv = info.dict_find_int_value("private") != 0;
+		bool const has_cert = !info.dict_find_string_value("ssl-cert").empty();
+
+		bool const modify_info = !opts.name.empty()
+			|| (opts.make_private_torrent && !priv)
+			|| (opts.make_public_torrent && priv)
+			|| opts.drop_mtime
+			|| !opts.drop_file.empty()
+			|| !opts.rename_file.empty()
+			|| !opts.root_cert.empty()
+			|| (opts.drop_root_cert && has_cert);
+
+		if (!modify_info) {
+			// none of the changes affect the info dictionary, so we can just
+			// copy it verbatim (along with the piece layers and anything else we
+			// don't touch) and only re-encode the fields that change.
+			lt::entry::dictionary_type changes;
+
+			if (opts.drop_trackers || !opts.trackers.empty()) {
+				auto trackers = opts.trackers;
+				if (!opts.drop_trackers) {
+					auto const input_trackers = load_trackers(torrent);
+					for (std::size_t tier = 0; tier < input_trackers.size(); ++tier) {
+						if (trackers.size() <= tier) trackers.resize(tier + 1);
+						trackers[tier].insert(trackers[tier].end()
+							, input_trackers[tier].begin(), input_trackers[tier].end());
+					}
+				}
+				trackers.erase(std::remove_if(trackers.begin(), trackers.end()
+					, [](std::vector<std::string> const& t) { return t.empty(); })
+					, trackers.end());
+
+				changes["announce"] = lt::entry();
+				changes["announce-list"] = lt::entry();
+				if (!trackers.empty()) {
+					changes["announce"] = trackers.front().front();
+					if (trackers.size() > 1 || trackers.front().size() > 1) {
+						auto& tiers = changes["announce-list"].list();
+						for (auto const& tt : trackers) {
+							auto& tier = tiers.emplace_back().list();
+							for (auto const& url : tt) tier.emplace_back(url);
+						}
+					}
+				}
+			}
+
+			if (opts.drop_web_seeds || !opts.web_seeds.empty()) {
+				auto web_seeds = opts.web_seeds;
+				if (!opts.drop_web_seeds) {
+					auto const input_seeds = load_web_seeds(torrent);
+					web_seeds.insert(web_seeds.end(), input_seeds.begin(), input_seeds.end());
+				}
+				changes["url-list"] = lt::entry();
+				changes["httpseeds"] = lt::entry();
+				if (!web_seeds.empty()) {
+					auto& ws = changes["url-list"].list();
+					for (auto const& url : web_seeds) ws.emplace_back(url);
+				}
+			}
+
+			if (opts.drop_dht_nodes || !opts.dht_nodes.empty()) {
+				auto dht_nodes = opts.dht_nodes;
+				if (!opts.drop_dht_nodes) {
+					auto const input_nodes = load_nodes(torrent);
+					dht_nodes.insert(dht_nodes.end(), input_nodes.begin(), input_nodes.end());
+				}
+				changes["nodes"] = lt::entry();
+				if (!dht_nodes.empty()) {
+					auto& nodes = changes["nodes"].list();
+					for (auto const& n : dht_nodes) {
+						auto& l = nodes.emplace_back().list();
+						l.emplace_back(n.first);
+						l.emplace_back(n.second);
+					}
+				}
+			}
+
+			if (opts.drop_comment) {
+				changes["comment"] = lt::entry();
+				changes["comment.utf-8"] = lt::entry();
+			}
+			if (!opts.comment_str.empty()) {
+				// clients prefer "comment.utf-8", an old one would hide the new
+				// comment
+				changes["comment"] = opts.comment_str;
+				changes["comment.utf-8"] = lt::entry();
+			}
+
+			if (opts.drop_creator) changes["created by"] = lt::entry();
+			if (!opts.creator.empty()) changes["created by"] = opts.creator;
+
+			if (opts.drop_creation_date) changes["creation date"] = lt::entry();
+
+			stats::scoped_timer timer(stats::timer::encode);
+			std::vector<char> torrent_buf;
+			torrent_buf.reserve(input_buf.size() + 1024);
+			splice_dict(torrent_buf, torrent, changes
+				, [&](std::string_view, lt::bdecode_node const&, lt::entry const& e) {
+					write_entry(torrent_buf, e);
+				});
+
+			return torrent_buf;
+		}
+	}
+
+	lt::torrent_info const input = [&] {
+		stats::scoped_timer timer(stats::timer::parse);
+		return lt::torrent_info(input_buf, lt::from_span);
+	}();
+	lt::file_storage const& input_fs = input.files();
+
+	bool const v1_only = !input.info_hashes().has_v2();
+	bool const v2_only = !input.info_hashes().has_v1();
+
+	// the path of file "f" of the input torrent. Only computed if needed by
+	// the rules (each call allocates)
+	auto const match_path = [&](file_matcher const& m, lt::file_index_t const f) {
+		return m.needs_path() ? input_fs.file_path(f) : std::string();
+	};
+
+	// returns the rename rule matching file "f", or -1. "path" may be empty,
+	// unless the rules need it
+	auto const rename_rule = [&](lt::file_index_t const f, std::string const& path) {
+		if (opts.rename_file.empty() || input_fs.pad_file_at(f)) return -1;
+		return opts.rename_file.match(path, input_fs.file_name(f)
+			, input_fs.file_size(f), input_fs.file_flags(f));
+	};
+
+	// applies "rule" to "path", the path of file "f" in the input torrent
+	auto const rename = [&](lt::file_index_t const f, int const rule, std::string& path) {
+		std::string const& to = opts.rename_to[std::size_t(rule)];
+		if (std::regex const* re = opts.rename_file.regex(rule))
+			path = std::regex_replace(path, *re, to, std::regex_constants::format_first_only);
+		else
+			path.replace(path.size() - input_fs.file_name(f).size(), std::string::npos, to);
+	};
+
+	// replaces the first element of "path", the torrent name, in-place
+	auto const replace_name = [&](std::string& path) {
+		path.replace(0, path.find_first_of("/\\"), opts.name);
+	};
+
+	// the input files to keep. For v2 and hybrid torrents create_torrent
+	// inserts its own pad files, but for v1-only torrents we preserve the
+	// original ones, to keep as many pieces aligned as possible. Except the
+	// pad file following a dropped file, since it belongs to it
+	std::vector<lt::file_index_t> keep;
+	bool dropped = false;
+	bool any_dropped = false;
+	for (auto f : input_fs.file_range()) {
+		if (input_fs.pad_file_at(f)) {
+			if (v1_only && !dropped) keep.push_back(f);
+			continue;
+		}
+
+		dropped = !opts.drop_file.empty()
+			&& opts.drop_file.match(match_path(opts.drop_file, f), input_fs.file_name(f)
+				, input_fs.file_size(f), input_fs.file_flags(f)) >= 0;
+		if (!dropped) keep.push_back(f);
+		any_dropped = any_dropped || dropped;
+	}
+	while (!keep.empty() && input_fs.pad_file_at(keep.back())) keep.pop_back();
+
+	int const piece_size = input.piece_length();
+
+	// the new file storage
+	lt::file_storage fs;
+
+	std::string path;
+	if (!any_dropped) {
+		// no files were dropped, so we can reuse the input file storage, with
+		// its tables of (borrowed) file names and directories, and just patch
+		// the name and the renamed files
+		fs = input_fs;
+		keep.clear();
+		for (auto f : input_fs.file_range()) keep.push_back(f);
+
+		if (!opts.name.empty()) {
+			fs.set_name(opts.name);
+			// the name of a single-file torrent is its file name
+			lt::file_index_t const first{0};
+			if (fs.num_files() == 1
+				&& input_fs.file_path(first).find_first_of("/\\") == std::string::npos)
+				fs.rename_file(first, opts.name);
+		}
+		for (auto f : input_fs.file_range()) {
+			path = match_path(opts.rename_file, f);
+			int const rule = rename_rule(f, path);
+			if (rule < 0) continue;
+			if (path.empty()) path = input_fs.file_path(f);
+			rename(f, rule, path);
+			if (!opts.name.empty()) replace_name(path);
+			fs.rename_file(f, path);
+		}
+	}
+	else {
+		fs.set_piece_length(piece_size);
+
+		// the file names are borrowed from the input torrent (unless renamed),
+		// and file_storage only copies the directory part when it changes. The
+		// path of each file is still built by file_path(), since file_storage
+		// doesn't expose its directory table, so that's one allocation per file
+		for (auto f : keep) {
+			lt::file_flags_t const file_flags = input_fs.file_flags(f);
+			std::string_view filename = input_fs.file_name(f);
+			path = input_fs.file_path(f);
+
+			if (int const rule = rename_rule(f, path); rule >= 0) {
+				rename(f, rule, path);
+				filename = {};
+			}
+			if (!opts.name.empty()) {
+				// the name of a single-file torrent is its file name
+				if (path.find_first_of("/\\") == std::string::npos) filename = {};
+				replace_name(path);
+			}
+
+			std::string const symlink_path
+				= file_flags & lt::file_storage::flag_symlink
+				? input_fs.symlink(f) : std::string();
+
+			fs.add_file_borrow(filename, path, input_fs.file_size(f), file_flags, nullptr
+				, input_fs.mtime(f), symlink_path, input_fs.root_ptr(f));
+		}
+	}
+
+	lt::create_flags_t flags = opts.flags;
+	// keep the file attributes of the input (mtime is only set if the input
+	// has it)
+	if (!opts.drop_mtime) flags |= lt::create_torrent::modification_time;
+	flags |= lt::create_torrent::symlinks;
+	if (v1_only) flags |= lt::create_torrent::v1_only;
+	if (v2_only) flags |= lt::create_torrent::v2_only;
+	lt::create_torrent t(fs, piece_size, flags);
+
+	// map the files of the new torrent back to the input files
+	std::vector<lt::file_index_t> const source = map_sources(t.files(), input_fs, keep, v1_only);
+
+
+	// comment
+	std::string const& comment = opts.drop_comment || !opts.comment_str.empty()
+		? opts.comment_str : input.comment();
+	if (!comment.empty())
+		t.set_comment(comment.c_str());
+
+	// creator
+	std::string const& creator = opts.drop_creator || !opts.creator.empty()
+		? opts.creator : input.creator();
+	if (!creator.empty())
+		t.set_creator(creator.c_str());
+
+	if (opts.drop_creation_date) {
+		t.set_creation_date(0);
+	}
+	else {
+		t.set_creation_date(input.creation_date());
+	}
+
+	// SSL root cert
+	std::string const root_cert = opts.drop_root_cert || !opts.root_cert.empty()
+		? opts.root_cert : std::string(input.ssl_cert());
+	if (!root_cert.empty()) {
+		t.set_root_cert(root_cert);
+	}
+
+	// propagate trackers
+	auto trackers = opts.trackers;
+	if (!opts.drop_trackers) {
+		for (auto const& tr : input.trackers()) {
+			int const tier = tr.tier;
+			if (int(trackers.size()) <= tier) trackers.resize(tier + 1);
+			trackers[tier].emplace_back(tr.url);
+		}
+	}
+
+	int tier = 0;
+	if (!trackers.empty()) {
+		for (auto const& tt : trackers) {
+			for (auto const& url : tt) {
+				t.add_tracker(url, tier);
+			}
+			++tier;
+		}
+	}
+
+	// propagate web seeds
+	auto web_seeds = opts.web_seeds;
+	if (!opts.drop_web_seeds) {
+		for (auto const& ws : input.web_seeds())
+			web_seeds.emplace_back(ws.url);
+	}
+	for (std::string const& ws : web_seeds)
+		t.add_url_seed(ws);
+
+	// DHT nodes
+	auto dht_nodes = opts.dht_nodes;
+	if (!opts.drop_dht_nodes) {
+		auto const& input_nodes = input.nodes();
+		dht_nodes.insert(dht_nodes.end(), input_nodes.begin(), input_nodes.end());
+	}
+	for (auto const& n : dht_nodes) {
+		t.add_node(n);
+	}
+
+	// propagate private flag
+	if (opts.make_private_torrent)
+		t.set_priv(true);
+	else if (opts.make_public_torrent)
+		t.set_priv(false);
+	else
+		t.set_priv(input.priv());
+
+	copy_hashes(t, input, source, opts.data_dir
+		, [&](lt::file_index_t const f) { return input.piece_layer(f); });
+
+	// create the torrent
+	stats::scoped_timer timer(stats::timer::encode);
+	std::vector<char> torrent;
+	lt::bencode(back_inserter(torrent), t.generate());
+	return torrent;
+}
+
+std::vector<char> load_torrent_file(std::string const& filename)
+{
+	stats::scoped_timer timer(stats::timer::parse);
+	return load_file(filename);
+}
+
+void save_file(std::string const& filename, std::vector<char> const& buf)
+{
+	stats::scoped_timer timer(stats::timer::write);
+	std::fstream out;
+	out.exceptions(std::ifstream::failbit);
+	out.open(filename.c_str(), std::ios_base::out | std::ios_base::binary);
+	out.write(buf.data(), int(buf.size()));
+	stats::add(stats::counter::bytes_written, std::int64_t(buf.size()));
+}
+
+// saves the torrent "buf" to "filename", and its sidecar if requested
+void save_torrent(modify_options const& opts, std::string const& filename
+	, std::vector<char> const& buf)
+{
+	save_file(filename, buf);
+	if (opts.sidecar) save_sidecar(filename + ".sidecar", buf);
+}
+
+// applies the same modifications to all torrents in "files", on a pool of
+// threads. The results either replace the input files or are written to
+// opts.out_dir
+int modify_bulk(modify_options const& opts, lt::span<char const*> files)
+{
+	namespace fs = std::filesystem;
+
+	// the file each input is written to. Two threads must never write the
+	// same one, e.g. inputs with the same name from different directories, or
+	// the same input listed twice
+	std::vector<std::string> outputs;
+	std::set<fs::path> unique_outputs;
+	for (char const* input : files) {
+		outputs.push_back(opts.in_place ? std::string(input)
+			: (fs::path(opts.out_dir) / fs::path(input).filename()).string());
+		if (!unique_outputs.insert(fs::weakly_canonical(outputs.back())).second)
+			throw std::runtime_error("more than one input would be written to \"" + outputs.back() + "\"");
+	}
+
+	if (!opts.out_dir.empty()) fs::create_directories(opts.out_dir);
+
+	std::atomic<std::size_t> next{0};
+	std::atomic<std::int64_t> total_bytes{0};
+	std::atomic<int> failed{0};
+	std::mutex print_mutex;
+
+	auto const start = std::chrono::steady_clock::now();
+
+	auto worker = [&] {
+		for (;;) {
+			std::size_t const i = next++;
+			if (i >= std::size_t(files.size())) break;
+			std::string const input = files[std::ptrdiff_t(i)];
+			std::string const& output = outputs[i];
+			try {
+				std::vector<char> const input_buf = load_torrent_file(input);
+				std::vector<char> const torrent = modify_torrent(opts, input_buf);
+				if (opts.in_place) {
+					// write to a temporary file first, to not leave a truncated
+					// torrent behind if we fail half-way
+					std::string const tmp = output + ".tmp";
+					save_file(tmp, torrent);
+					fs::rename(tmp, output);
+					if (opts.sidecar) save_sidecar(output + ".sidecar", torrent);
+				}
+				else {
+					save_torrent(opts, output, torrent);
+				}
+				total_bytes += std::int64_t(input_buf.size());
+				if (!opts.quiet) {
+					std::lock_guard<std::mutex> l(print_mutex);
+					std::cout << "OK     " << input << '\n';
+				}
+			}
+			catch (std::exception const& e) {
+				++failed;
+				std::lock_guard<std::mutex> l(print_mutex);
+				std::cerr << "FAILED " << input << ": " << e.what() << '\n';
+			}
+		}
+	};
+
+	int const threads = std::max(1, std::min(opts.num_threads, int(files.size())));
+	std::vector<std::thread> pool;
+	for (int i = 1; i < threads; ++i) pool.emplace_back(worker);
+	worker();
+	for (auto& t : pool) t.join();
+
+	double const seconds = std::max(0.001, std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - start).count());
+
+	if (!opts.quiet) {
+		std::cout << files.size() << " torrents (" << failed << " failed) in "
+			<< seconds << " s, "
+			<< (double(total_bytes) / (1024 * 1024) / seconds) << " MB/s, "
+			<< (double(files.size()) / seconds) << " torrents/s\n";
+	}
+	return failed > 0 ? 1 : 0;
+}
+
+} // anonymous namespace
+
+int main(int argc_, char const* argv_[]) try
+{
+	lt::span<char const*> args(argv_, argc_);
+	// strip executable name
+	args = args.subspan(1);
+
+	if (args.size() < 2) {
+		print_usage();
+		return 1;
+	}
+
+	modify_options opts;
 	std::string output_file = "a.torrent";
 
 	while (args.size() > 0 && args[0][0] == '-') {
@@ -152,87 +747,139 @@ int main(int argc_, char const* argv_[]) try
 		else if ((args[0] == "-t"sv || args[0] == "--tracker"sv) && args.size() > 1) {
 			std::string t = args[1];
 			args = args.subspan(1);
-			trackers.emplace_back(std::vector<std::string>{std::move(t)});
+			opts.trackers.emplace_back(std::vector<std::string>{std::move(t)});
 		}
 		else if ((args[0] == "-T"sv || args[0] == "--tracker-tier"sv) && args.size() > 1) {
 			std::string t = args[1];
 			args = args.subspan(1);
-			if (trackers.empty())
-				trackers.emplace_back(std::vector<std::string>{std::move(t)});
+			if (opts.trackers.empty())
+				opts.trackers.emplace_back(std::vector<std::string>{std::move(t)});
 			else
-				trackers.back().emplace_back(std::move(t));
+				opts.trackers.back().emplace_back(std::move(t));
 		}
 		else if ((args[0] == "-w"sv || args[0] == "--web-seed"sv) && args.size() > 1) {
-			web_seeds.emplace_back(args[1]);
+			opts.web_seeds.emplace_back(args[1]);
 			args = args.subspan(1);
 		}
 		else if (args[0] == "--dht-node"sv && args.size() > 2) {
-			dht_nodes.emplace_back(args[1], std::atoi(args[2]));
+			opts.dht_nodes.emplace_back(args[1], std::atoi(args[2]));
 			args = args.subspan(2);
 		}
 		else if ((args[0] == "-C"sv || args[0] == "--creator"sv) && args.size() > 1) {
-			creator = args[1];
+			opts.creator = args[1];
 			args = args.subspan(1);
 		}
 		else if ((args[0] == "-c"sv || args[0] == "--comment"sv) && args.size() > 1) {
-			comment_str = args[1];
+			opts.comment_str = args[1];
 			args = args.subspan(1);
 		}
 		else if (args[0] == "--drop-file"sv && args.size() > 1) {
-			drop_file.emplace(args[1]);
+			opts.drop_file.add_name(args[1]);
 			args = args.subspan(1);
 		}
+		else if (args[0] == "--drop"sv && args.size() > 1) {
+			opts.drop_file.add_glob(args[1]);
+			args = args.subspan(1);
+		}
+		else if (args[0] == "--drop-regex"sv && args.size() > 1) {
+			opts.drop_file.add_regex(args[1]);
+			args = args.subspan(1);
+		}
+		else if (args[0] == "--drop-smaller"sv && args.size() > 1) {
+			opts.drop_file.add_size(0, parse_size(args[1]) - 1);
+			args = args.subspan(1);
+		}
+		else if (args[0] == "--drop-larger"sv && args.size() > 1) {
+			opts.drop_file.add_size(parse_size(args[1]) + 1
+				, std::numeric_limits<std::int64_t>::max());
+			args = args.subspan(1);
+		}
+		else if (args[0] == "--drop-attr"sv && args.size() > 1) {
+			opts.drop_file.add_attributes(parse_attributes(args[1]));
+			args = args.subspan(1);
+		}
+		else if (args[0] == "--data-dir"sv && args.size() > 1) {
+			opts.data_dir = args[1];
+			args = args.subspan(1);
+		}
+		else if (stats::parse_option(args[0])) {
+		}
 		else if (args[0] == "--rename-file"sv && args.size() > 2) {
-			rename_file.emplace(args[1], args[2]);
+			opts.rename_file.add_name(args[1]);
+			opts.rename_to.emplace_back(args[2]);
+			args = args.subspan(2);
+		}
+		else if (args[0] == "--rename"sv && args.size() > 2) {
+			opts.rename_file.add_glob(args[1]);
+			opts.rename_to.emplace_back(args[2]);
+			args = args.subspan(2);
+		}
+		else if (args[0] == "--rename-regex"sv && args.size() > 2) {
+			opts.rename_file.add_regex(args[1]);
+			opts.rename_to.emplace_back(args[2]);
 			args = args.subspan(2);
 		}
 		else if (args[0] == "--drop-trackers"sv) {
-			drop_trackers = true;
+			opts.drop_trackers = true;
 		}
 		else if (args[0] == "--drop-mtime"sv) {
-			drop_mtime = true;
+			opts.drop_mtime = true;
 		}
 		else if (args[0] == "--drop-web-seeds"sv) {
-			drop_web_seeds = true;
+			opts.drop_web_seeds = true;
 		}
 		else if (args[0] == "--drop-dht-nodes"sv) {
-			drop_dht_nodes = true;
+			opts.drop_dht_nodes = true;
 		}
 		else if (args[0] == "--drop-comment"sv) {
-			drop_comment = true;
+			opts.drop_comment = true;
 		}
 		else if (args[0] == "--drop-creator"sv) {
-			drop_creator = true;
+			opts.drop_creator = true;
 		}
 		else if (args[0] == "--drop-creation-date"sv) {
-			drop_creation_date = true;
+			opts.drop_creation_date = true;
 		}
 		else if (args[0] == "--drop-root-cert"sv) {
-			drop_root_cert = true;
+			opts.drop_root_cert = true;
 		}
 		else if (args[0] == "--private"sv) {
-			make_private_torrent = true;
+			opts.make_private_torrent = true;
 		}
 		else if (args[0] == "--public"sv) {
-			make_public_torrent = true;
+			opts.make_public_torrent = true;
 		}
 		else if ((args[0] == "-r"sv || args[0] == "--root-cert"sv) && args.size() > 1) {
 			std::string cert_path = args[1];
 
-			if (!quiet) std::cout << "loading " << cert_path << '\n';
+			if (!opts.quiet) std::cout << "loading " << cert_path << '\n';
 			std::vector<char> const pem = load_file(cert_path);
-			root_cert.assign(pem.data(), pem.size());
+			opts.root_cert.assign(pem.data(), pem.size());
 			args = args.subspan(1);
 		}
 		else if (args[0] == "-q"sv) {
-			quiet = true;
+			opts.quiet = true;
+		}
+		else if (args[0] == "--sidecar"sv) {
+			opts.sidecar = true;
+		}
+		else if (args[0] == "--in-place"sv) {
+			opts.in_place = true;
+		}
+		else if (args[0] == "--out-dir"sv && args.size() > 1) {
+			opts.out_dir = args[1];
+			args = args.subspan(1);
+		}
+		else if (args[0] == "--threads"sv && args.size() > 1) {
+			opts.num_threads = atoi(args[1]);
+			args = args.subspan(1);
 		}
 		else if (args[0] == "-h"sv || args[0] == "--help"sv) {
 			print_usage();
 			return 0;
 		}
 		else if ((args[0] == "-n"sv || args[0] == "--name"sv) && args.size() > 1) {
-			name = args[1];
+			opts.name = args[1];
 			args = args.subspan(1);
 		}
 		else {
@@ -243,192 +890,36 @@ int main(int argc_, char const* argv_[]) try
 		args = args.subspan(1);
 	}
 
-	if (make_public_torrent && make_private_torrent) {
-		std::cerr << "the flags --public and --private are incompatible\n";
+	if (opts.in_place && !opts.out_dir.empty()) {
+		std::cerr << "the options --in-place and --out-dir are incompatible\n";
 		print_usage();
 		return 1;
 	}
 
-	if (args.empty()) {
+	if (opts.make_public_torrent && opts.make_private_torrent) {
+		std::cerr << "the flags --public and --private are incompatible\n";
 		print_usage();
-		std::cerr << "no torrent file specified.\n";
 		return 1;
 	}
-	std::string full_path = args[0];
 
-	if (args.size() > 1) {
+	if (args.empty()) {
 		print_usage();
-		std::cerr << "ignored command line arguments after input file\n";
+		std::cerr << "no torrent file specified.\n";
 		return 1;
 	}
 
-	lt::torrent_info input(full_path);
-	lt::file_storage const& input_fs = input.files();
-
-	// the new file storage
-	lt::file_storage fs;
-	std::vector<file_metadata> file_info;
-
-	int const piece_size = input.piece_length();
-	fs.set_piece_length(piece_size);
-
-	for (auto f : input_fs.file_range()) {
-
-		lt::file_flags_t const file_flags = input_fs.file_flags(f);
-		if (file_flags & lt::file_storage::flag_pad_file) continue;
-
-		std::int64_t const file_offset = input_fs.file_offset(f);
-		if ((file_offset % piece_size) != 0) {
-			std::cerr << "file " << f << " (" << input_fs.file_name(f) << ") is not piece-aligned\n";
+	if (!opts.in_place && opts.out_dir.empty()) {
+		if (args.size() > 1) {
+			print_usage();
+			std::cerr << "ignored command line arguments after input file\n";
 			return 1;
 		}
 
-		std::string path = input_fs.file_path(f);
-		std::int64_t const file_size = input_fs.file_size(f);
-		std::time_t const mtime = drop_mtime ? 0 : input_fs.mtime(f);
-		std::string const symlink_path
-			= file_flags & lt::file_storage::flag_symlink
-			? input_fs.symlink(f) : std::string();
-		char const* root_hash = input_fs.root_ptr(f);
-
-		auto const [parent, filename] = right_split(path);
-
-		// ignore files whose name match one in drop_file
-		if (!drop_file.empty()) {
-			if (drop_file.count(filename))
-				continue;
-		}
-
-		if (!name.empty()) {
-			path = replace_directory_element(path, name);
-		}
-
-		if (auto it = rename_file.find(filename); it != rename_file.end()) {
-#ifdef TORRENT_WINDOWS
-			path = parent + '\\' + it->second;
-#else
-			path = parent + '/' + it->second;
-#endif
-		}
-
-		auto const idx = fs.end_file();
-		fs.add_file(path, file_size, file_flags, mtime, symlink_path, root_hash);
-		file_info.push_back(file_metadata{
-			lt::index_range<lt::piece_index_t>{
-				lt::piece_index_t(file_offset / piece_size)
-				, lt::piece_index_t((file_offset + input_fs.file_size(f) + piece_size - 1) / piece_size)}
-			, input.piece_layer(f)
-			, root_hash
-			, idx
-			});
-	}
-
-	lt::create_torrent t(fs, piece_size, flags);
-
-	// comment
-	if (!drop_comment && comment_str.empty())
-		comment_str = input.comment();
-
-	if (!comment_str.empty())
-		t.set_comment(comment_str.c_str());
-
-	// creator
-	if (!drop_creator && creator.empty())
-		creator = input.creator();
-
-	if (!creator.empty())
-		t.set_creator(creator.c_str());
-
-	if (drop_creation_date) {
-		t.set_creation_date(0);
-	}
-	else {
-		t.set_creation_date(input.creation_date());
-	}
-
-	// SSL root cert
-	if (!drop_root_cert && root_cert.empty()) {
-		root_cert = std::string(input.ssl_cert());
-	}
-
-	if (!root_cert.empty()) {
-		t.set_root_cert(root_cert);
-	}
-
-	// propagate trackers
-	if (!drop_trackers) {
-		for (auto const& tr : input.trackers()) {
-			int const tier = tr.tier;
-			if (int(trackers.size()) <= tier) trackers.resize(tier + 1);
-			trackers[tier].emplace_back(tr.url);
-		}
-	}
-
-	int tier = 0;
-	if (!trackers.empty()) {
-		for (auto const& tt : trackers) {
-			for (auto const& url : tt) {
-				t.add_tracker(url, tier);
-			}
-			++tier;
-		}
-	}
-
-	// propagate web seeds
-	if (!drop_web_seeds) {
-		for (auto const& ws : input.web_seeds())
-			web_seeds.emplace_back(ws.url);
+		save_torrent(opts, output_file, modify_torrent(opts, load_torrent_file(args[0])));
+		return 0;
 	}
-	for (std::string const& ws : web_seeds)
-		t.add_url_seed(ws);
-
-	// DHT nodes
-	if (!drop_dht_nodes) {
-		auto const& input_nodes = input.nodes();
-		dht_nodes.insert(dht_nodes.end(), input_nodes.begin(), input_nodes.end());
-	}
-	for (auto const& n : dht_nodes) {
-		t.add_node(n);
-	}
-
-	// propagate private flag
-	if (make_private_torrent)
-		t.set_priv(true);
-	else if (make_public_torrent)
-		t.set_priv(false);
-	else
-		t.set_priv(input.priv());
-
-	if (input.info_hashes().has_v1()) {
-		lt::piece_index_t p{};
-		for (auto const& info : file_info) {
-			for (lt::piece_index_t i : info.pieces) {
-				t.set_hash(p++, input.hash_for_piece(i));
-			}
-		}
-	}
-
-	if (input.info_hashes().has_v2()) {
-		for (auto const& info : file_info) {
-			if (fs.pad_file_at(info.idx))
-				continue;
-			lt::piece_index_t::diff_type p{0};
-			for (int h = 0; h < int(info.piece_layer.size()); h += int(lt::sha256_hash::size())) {
-				t.set_hash2(info.idx, p++, lt::sha256_hash(info.piece_layer.data() + h));
-			}
-		}
-	}
-
-	// create the torrent and print it
-	std::vector<char> torrent;
-	lt::bencode(back_inserter(torrent), t.generate());
-
-	std::fstream out;
-	out.exceptions(std::ifstream::failbit);
-	out.open(output_file.c_str(), std::ios_base::out | std::ios_base::binary);
-	out.write(torrent.data(), int(torrent.size()));
 
-	return 0;
+	return modify_bulk(opts, args);
 }
 catch (std::exception& e) {
 	std::cerr << "ERROR: " << e.what() << "\n";
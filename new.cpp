@@ -11,9 +11,12 @@ see LICENSE file.
 #include "libtorrent/bencode.hpp"
 #include "libtorrent/torrent_info.hpp"
 #include "libtorrent/create_torrent.hpp"
-#include "libtorrent/settings_pack.hpp"
 
 #include "common.hpp"
+#include "hash_files.hpp"
+#include "output_file.hpp"
+#include "sidecar.hpp"
+#include "stats.hpp"
 
 #include <functional>
 #include <cstdio>
@@ -21,9 +24,19 @@ see LICENSE file.
 #include <fstream>
 #include <iostream>
 #include <thread>
+#include <memory>
+#include <unordered_map>
+#include <map>
+#include <tuple>
+#include <cstring> // for strerror
+#include <filesystem>
+
+#include <sys/stat.h>
 
 #ifdef TORRENT_WINDOWS
 #include <direct.h> // for _getcwd
+#include <fcntl.h> // for _O_BINARY
+#include <io.h> // for _setmode
 #endif
 
 #include <string_view>
@@ -65,9 +78,12 @@ int const default_num_threads
 void print_usage()
 {
 	std::cerr << R"(USAGE: torrent-new [OPTIONS] file
+       torrent-new [OPTIONS] --stdin --name <name> [--size <bytes>]
 
 Generates a torrent file from the specified file
-or directory and writes it to an output .torrent file
+or directory and writes it to an output .torrent file.
+With --stdin, the torrent has a single file, whose content
+is read from stdin.
 
 OPTIONS:
 -o, --out <file>             Print resulting torrent to the specified file.
@@ -94,6 +110,43 @@ OPTIONS:
 
 --threads <n>                Use <n> threads to hash pieces. Defaults to )"
 	<< default_num_threads << R"(.
+--hdd-depth <n>              The number of concurrent reads per spinning disk.
+                             Defaults to 1
+--ssd-depth <n>              The number of concurrent reads per device that isn't
+                             a spinning disk. Defaults to 4
+--hdd                        Optimize for reading from spinning disks. Files are
+                             read in the order they are laid out on disk (using
+                             FIEMAP, on Linux), in 8 MiB chunks, with readahead.
+                             All devices are treated as spinning disks. The
+                             order of files in the torrent is not affected.
+--copy-to <dir>              Copy the files to <dir> while hashing them, reading
+                             them only once. The torrent is the same as one
+                             created from the copy (modification times and
+                             permissions are copied too).
+--reflinks                   Files that share all their storage (e.g. reflinked
+                             copies, as reported by FIEMAP, on Linux) are only
+                             hashed once. Hard links are always only hashed once.
+--base <torrent>             Only hash files that are new or have changed since
+                             the specified torrent was created. Files with the
+                             same path, size and modification time as in the base
+                             torrent take their hashes from it. The base torrent
+                             must have been created with --mtime, and have the
+                             same piece size (which is the default).
+--stats[=json]               Print where time was spent (listing files, reading,
+                             hashing, writing etc.) to stderr on exit
+--stdin                      Hash the content streamed to stdin, as a single file
+                             torrent. It's hashed as it streams through, nothing
+                             is stored on disk (unless --tee is used).
+--name <name>                The name of the file, with --stdin.
+--size <bytes>               The size of the content on stdin. If it's not known,
+                             the piece size must be specified (-s) for hybrid
+                             torrents, or the torrent be v2-only (-2).
+--tee <file>                 With --stdin, also write the content to <file>.
+--sidecar                    Also write the file roots and piece layers to
+                             <out>.sidecar, a binary index that torrent-verify,
+                             torrent-merge and torrent-print can use instead of
+                             parsing the piece layers of the torrent
+                             (--use-sidecars).
 
 To manage tracker tiers -t will add a new tier immediately before adding the
 tracker whereas -T will add the tracker to the current tier. If there is no
@@ -109,6 +162,442 @@ Will add foo and bar as the same tier.
 )";
 }
 
+struct hash_options
+{
+	int num_threads;
+	// the number of concurrent reads per device, see device_table::read_depth()
+	int hdd_depth;
+	int ssd_depth;
+	// all files are on spinning disks. Read them in the order they are laid
+	// out on disk, in large chunks
+	bool hdd;
+	bool quiet;
+	// if set, the files are copied to this directory while they're hashed
+	std::string copy_to;
+	// also hash files that share all their storage (reflinked copies) once,
+	// not just hard links
+	bool reflinks;
+};
+
+// hashes "files" of "t", reading them from "save_path", and sets their v2
+// hashes, and v1 hashes for hybrid torrents, in "t". The files of hybrid
+// torrents are piece-aligned, so both are computed while reading the files
+// once. Every device is read from independently, sharing the hashing threads.
+// If opts.copy_to is set, the files are copied there, from the same buffers
+void hash_torrent_files(lt::create_torrent& t, std::string const& save_path
+	, lt::span<lt::file_index_t const> files, hash_options const& opts)
+{
+	lt::file_storage const& fs = t.files();
+	bool const v1 = !t.is_v2_only();
+	bool const show_progress = !opts.quiet && stdout_is_tty();
+
+	device_table devices;
+	std::vector<file_hashes> hashes;
+	hashes.reserve(std::size_t(files.size()));
+	std::int64_t total_size = 0;
+
+	// files with the same content are only hashed once: hard links to the same
+	// inode and, with opts.reflinks, files sharing all their storage. "source"
+	// maps every file to the entry in "hashes" with its hashes. The last v1
+	// piece is only the same if both files are padded, or both are not
+	std::map<std::tuple<std::uint64_t, std::uint64_t, bool>, std::size_t> inodes;
+	std::map<std::tuple<std::uint64_t, std::int64_t, std::string, bool>, std::size_t> extents;
+	std::vector<std::size_t> source;
+	source.reserve(std::size_t(files.size()));
+	// the files (indices into "files") whose hashes come from another one
+	std::vector<std::size_t> duplicates;
+
+	for (auto const f : files) {
+		std::string path = fs.file_path(f, save_path);
+		std::int64_t const size = fs.file_size(f);
+		// the last piece of a file is padded, unless it's the last file
+		bool const v1_pad = v1 && f + lt::file_index_t::diff_type{1} < fs.end_file()
+			&& fs.pad_file_at(f + lt::file_index_t::diff_type{1});
+
+		std::size_t idx = hashes.size();
+#if !defined TORRENT_WINDOWS
+		struct stat st;
+		bool known = false;
+		{
+			stats::scoped_timer timer(stats::timer::stat);
+			known = ::stat(path.c_str(), &st) == 0;
+		}
+		// if it can't be stat()ed, reading it will report the error
+		if (known) {
+			auto const key = std::make_tuple(std::uint64_t(st.st_dev), std::uint64_t(st.st_ino), v1_pad);
+			auto const it = inodes.find(key);
+			if (it != inodes.end()) {
+				idx = it->second;
+			}
+			else {
+				if (opts.reflinks) {
+					std::string map = extent_map(path);
+					if (!map.empty()) {
+						idx = extents.emplace(std::make_tuple(std::uint64_t(st.st_dev), size
+							, std::move(map), v1_pad), idx).first->second;
+					}
+				}
+				inodes.emplace(key, idx);
+			}
+		}
+#endif
+		source.push_back(idx);
+		if (idx < hashes.size()) {
+			duplicates.push_back(source.size() - 1);
+			continue;
+		}
+
+		auto& h = hashes.emplace_back();
+		h.path = std::move(path);
+		h.size = size;
+		h.device = devices.lookup(h.path);
+		if (opts.hdd) h.physical_offset = physical_offset(h.path);
+		if (!opts.copy_to.empty()) h.copy_to = fs.file_path(f, opts.copy_to);
+		h.v1 = v1;
+		h.v1_pad = v1_pad;
+		total_size += h.size;
+	}
+
+	read_options ropts;
+	ropts.device_depth = devices.read_depth(opts.hdd_depth, opts.hdd ? opts.hdd_depth : opts.ssd_depth);
+	if (opts.hdd) {
+		ropts.job_size = 8 * 1024 * 1024;
+		ropts.readahead = true;
+	}
+	progress_reporter progress(total_size, int(hashes.size()), devices.names()
+		, show_progress && total_size > 0);
+	hash_files(hashes, fs.piece_length(), opts.num_threads, &progress, {}, ropts);
+
+	// duplicates were not read, so they weren't copied either. Hard links are
+	// linked in the copy too, other duplicates are copied from the copy
+	if (!opts.copy_to.empty()) {
+		namespace fs_ = std::filesystem;
+		for (std::size_t const i : duplicates) {
+			lt::file_index_t const f = files[std::ptrdiff_t(i)];
+			auto const& hash = hashes[source[i]];
+			fs_::path const dest = fs.file_path(f, opts.copy_to);
+			fs_::remove(dest);
+			if (fs_::equivalent(fs.file_path(f, save_path), hash.path))
+				fs_::create_hard_link(hash.copy_to, dest);
+			else
+				fs_::copy_file(hash.copy_to, dest);
+		}
+	}
+
+	for (std::size_t i = 0; i < source.size(); ++i) {
+		lt::file_index_t const f = files[std::ptrdiff_t(i)];
+		auto const& hash = hashes[source[i]];
+		lt::piece_index_t::diff_type p{0};
+		for (auto const& h : hash.piece_layer)
+			t.set_hash2(f, p++, h);
+
+		lt::piece_index_t piece = fs.map_file(f, 0, 0).piece;
+		for (auto const& h : hash.v1_pieces)
+			t.set_hash(piece++, h);
+	}
+}
+
+// creates the directories of the files of "fs" under "copy_to", as well as the
+// files that aren't copied while they're hashed: empty files and symlinks
+void prepare_copy(lt::file_storage const& fs, std::string const& save_path
+	, std::string const& copy_to)
+{
+	namespace fs_ = std::filesystem;
+	for (auto const f : fs.file_range()) {
+		if (fs.pad_file_at(f)) continue;
+		fs_::path const dest = fs.file_path(f, copy_to);
+		fs_::create_directories(dest.parent_path());
+		if (fs.file_flags(f) & lt::file_storage::flag_symlink) {
+			fs_::remove(dest);
+			fs_::create_symlink(fs_::read_symlink(fs.file_path(f, save_path)), dest);
+		}
+		else if (fs.file_size(f) == 0) {
+			output_file out;
+			out.open(dest.string());
+			out.close();
+		}
+	}
+}
+
+// copies the modification times and permissions of the files of "fs" to their
+// copies, so that a torrent created from the copies is the same
+void finish_copy(lt::file_storage const& fs, std::string const& save_path
+	, std::string const& copy_to)
+{
+	namespace fs_ = std::filesystem;
+	for (auto const f : fs.file_range()) {
+		if (fs.pad_file_at(f)) continue;
+		if (fs.file_flags(f) & lt::file_storage::flag_symlink) continue;
+		fs_::path const src = fs.file_path(f, save_path);
+		fs_::path const dest = fs.file_path(f, copy_to);
+		fs_::permissions(dest, fs_::status(src).permissions());
+		fs_::last_write_time(dest, fs_::last_write_time(src));
+	}
+}
+
+// the hashes of the content of stdin
+struct stream_hashes
+{
+	std::int64_t size = 0;
+
+	// the v2 hashes don't depend on the piece size, so the hashes of the 16 kiB
+	// blocks are kept until it's known (0.2% of the size of the content)
+	std::vector<lt::sha256_hash> blocks;
+
+	// the v1 hashes do, so they can only be computed if the piece size is
+	// known up front
+	std::vector<lt::sha1_hash> v1_pieces;
+};
+
+// reads up to "len" bytes from stdin. Fewer are only returned at the end of
+// the stream
+std::int64_t read_stdin(char* buf, std::int64_t const len)
+{
+	std::int64_t ret = 0;
+	while (ret < len) {
+		std::size_t const n = std::fread(buf + ret, 1, std::size_t(len - ret), stdin);
+		if (n == 0) {
+			if (std::ferror(stdin)) throw std::runtime_error("failed to read from stdin");
+			break;
+		}
+		ret += std::int64_t(n);
+	}
+	return ret;
+}
+
+// hashes the content of stdin as it streams through, and writes it to
+// "tee_path", unless it's empty. v1 hashes are computed if "v1_piece_size" is
+// not 0. "expected_size" is the size of the content, or -1 if it's not known
+stream_hashes hash_stdin(int const v1_piece_size, std::int64_t const expected_size
+	, std::string const& tee_path, bool const show_progress)
+{
+	// a whole number of pieces (which are powers of 2)
+	int const chunk_size = std::max(v1_piece_size, 4 * 1024 * 1024);
+	std::unique_ptr<char[]> buf(new char[std::size_t(chunk_size)]);
+
+	output_file tee;
+	if (!tee_path.empty()) {
+		try { tee.open(tee_path); }
+		catch (std::exception const& e) {
+			throw std::runtime_error("failed to open \"" + tee_path + "\": " + e.what());
+		}
+	}
+
+	progress_reporter progress(std::max(expected_size, std::int64_t(0)), 1, {}
+		, show_progress && expected_size > 0);
+	stream_hashes ret;
+	for (;;) {
+		std::int64_t n = 0;
+		{
+			stats::scoped_timer timer(stats::timer::read);
+			n = read_stdin(buf.get(), chunk_size);
+		}
+		stats::add(stats::counter::bytes_read, n);
+		if (expected_size >= 0 && ret.size + n > expected_size) {
+			throw std::runtime_error("stdin has more than the " + std::to_string(expected_size)
+				+ " bytes specified by --size");
+		}
+
+		if (tee.is_open() && n > 0) {
+			stats::scoped_timer timer(stats::timer::write);
+			try { tee.write(buf.get(), n); }
+			catch (std::exception const& e) {
+				throw std::runtime_error("failed to write \"" + tee_path + "\": " + e.what());
+			}
+			stats::add(stats::counter::bytes_written, n);
+		}
+
+		{
+			stats::scoped_timer timer(stats::timer::sha256);
+			for (std::int64_t i = 0; i < n; i += merkle_block_size) {
+				int const len = int(std::min(std::int64_t(merkle_block_size), n - i));
+				ret.blocks.push_back(lt::hasher256(buf.get() + i, len).final());
+			}
+		}
+		if (v1_piece_size > 0) {
+			stats::scoped_timer timer(stats::timer::sha1);
+			for (std::int64_t i = 0; i < n; i += v1_piece_size) {
+				int const len = int(std::min(std::int64_t(v1_piece_size), n - i));
+				ret.v1_pieces.push_back(lt::hasher(buf.get() + i, len).final());
+			}
+		}
+		ret.size += n;
+		progress.bytes_done(n);
+		if (n < chunk_size) break;
+	}
+	progress.file_done();
+
+	if (tee.is_open()) {
+		try { tee.close(); }
+		catch (std::exception const& e) {
+			throw std::runtime_error("failed to write \"" + tee_path + "\": " + e.what());
+		}
+	}
+	if (ret.size == 0) throw std::runtime_error("stdin is empty");
+	if (expected_size >= 0 && ret.size != expected_size) {
+		throw std::runtime_error("stdin ended after " + std::to_string(ret.size)
+			+ " bytes, but --size specified " + std::to_string(expected_size));
+	}
+	return ret;
+}
+
+// sets the hashes of the single file of "t", computed by hash_stdin()
+void set_stream_hashes(lt::create_torrent& t, stream_hashes h)
+{
+	// raise the block hashes up to the piece layer (or the root, for a file
+	// that fits in a single piece)
+	merkle_raise_layer(h.blocks, 0, merkle_depth(std::size_t(t.piece_length() / merkle_block_size)));
+	lt::file_index_t const f{0};
+	lt::piece_index_t::diff_type p{0};
+	for (auto const& hash : h.blocks)
+		t.set_hash2(f, p++, hash);
+
+	if (t.is_v2_only()) return;
+	if (t.num_pieces() != int(h.v1_pieces.size()))
+		throw std::logic_error("the v1 pieces of stdin were hashed with the wrong piece size");
+	lt::piece_index_t piece{0};
+	for (auto const& hash : h.v1_pieces)
+		t.set_hash(piece++, hash);
+}
+
+// returns true if file "f" is followed by a pad file, i.e. its last v1 piece
+// is padded with zeros
+bool padded(lt::file_storage const& fs, lt::file_index_t const f)
+{
+	lt::file_index_t const next = f + lt::file_index_t::diff_type{1};
+	return next < fs.end_file() && fs.pad_file_at(next);
+}
+
+// hashes the last v1 piece of the file "path", of "size" bytes. If "pad" is
+// set, it's padded with zeros to a whole piece
+lt::sha1_hash hash_last_piece(std::string const& path, std::int64_t const size
+	, int const piece_size, bool const pad)
+{
+	std::int64_t const offset = (size - 1) / piece_size * piece_size;
+	std::vector<char> buf(std::size_t(size - offset));
+	try {
+		input_file f;
+		f.open(path);
+		stats::add(stats::counter::files_opened, 1);
+		stats::scoped_timer timer(stats::timer::read);
+		f.read(offset, buf.data(), std::int64_t(buf.size()));
+	}
+	catch (std::exception const& e) {
+		throw std::runtime_error("failed to hash \"" + path + "\": " + e.what());
+	}
+	stats::add(stats::counter::bytes_read, std::int64_t(buf.size()));
+	stats::scoped_timer timer(stats::timer::sha1);
+	lt::hasher h(buf.data(), int(buf.size()));
+	if (pad) hash_zeros(h, piece_size - std::int64_t(buf.size()));
+	return h.final();
+}
+
+// sets the hashes of the files in "t" that are unchanged compared to "base"
+// (same path, size and modification time) by copying them from "base". The
+// new and changed files are hashed from disk. Prints which files are new,
+// changed or removed.
+void hash_from_base(lt::create_torrent& t, lt::torrent_info const& base
+	, std::string const& save_path, hash_options const& opts)
+{
+	lt::file_storage const& fs = t.files();
+	lt::file_storage const& base_fs = base.files();
+	int const piece_size = fs.piece_length();
+	bool const quiet = opts.quiet;
+
+	if (!base.info_hashes().has_v2())
+		throw std::runtime_error("the base torrent must be a v2 or hybrid torrent");
+	if (base.piece_length() != piece_size)
+		throw std::runtime_error("the base torrent has a different piece size ("
+			+ std::to_string(base.piece_length()) + ")");
+
+	bool const v1 = !t.is_v2_only();
+	// in hybrid torrents all files are piece-aligned, so their v1 pieces can
+	// be copied too. If the base torrent doesn't have any, unchanged files are
+	// hashed again too
+	bool const base_v1 = base.info_hashes().has_v1();
+
+	std::unordered_map<std::string, lt::file_index_t> base_files;
+	for (auto const f : base_fs.file_range()) {
+		if (base_fs.pad_file_at(f)) continue;
+		base_files.emplace(base_fs.file_path(f), f);
+	}
+
+	std::vector<lt::file_index_t> to_hash;
+	int changed = 0;
+	int unchanged = 0;
+	int new_files = 0;
+
+	for (auto const f : fs.file_range()) {
+		if (fs.pad_file_at(f) || fs.file_size(f) == 0) continue;
+
+		std::string const path = fs.file_path(f);
+		std::string const full_path = fs.file_path(f, save_path);
+		struct stat st;
+		{
+			stats::scoped_timer timer(stats::timer::stat);
+			if (::stat(full_path.c_str(), &st) != 0)
+				throw std::runtime_error("failed to stat \"" + full_path + "\": " + strerror(errno));
+		}
+
+		auto const it = base_files.find(path);
+		if (it == base_files.end()
+			|| base_fs.file_size(it->second) != fs.file_size(f)
+			|| base_fs.mtime(it->second) == 0
+			|| base_fs.mtime(it->second) != st.st_mtime) {
+			if (!quiet) std::cout << (it == base_files.end() ? "new: " : "changed: ") << path << '\n';
+			if (it == base_files.end()) ++new_files;
+			else {
+				base_files.erase(it);
+				++changed;
+			}
+			to_hash.push_back(f);
+			continue;
+		}
+
+		lt::file_index_t const bf = it->second;
+		base_files.erase(it);
+		++unchanged;
+
+		if (v1 && !base_v1) {
+			to_hash.push_back(f);
+			continue;
+		}
+
+		auto const layer = base.piece_layer(bf);
+		lt::piece_index_t::diff_type p{0};
+		for (int h = 0; h < int(layer.size()); h += int(lt::sha256_hash::size())) {
+			t.set_hash2(f, p++, lt::sha256_hash(layer.data() + h));
+		}
+
+		if (!v1) continue;
+		lt::piece_index_t const first_piece = fs.map_file(f, 0, 0).piece;
+		lt::piece_index_t const base_first = base_fs.map_file(bf, 0, 0).piece;
+		int const num_pieces = fs.file_num_pieces(f);
+		// the last piece includes the zeros of the pad file following the file,
+		// if there is one. The file may have become, or stopped being, the last
+		// one, in which case its last piece has to be hashed again
+		bool const same_last = fs.file_size(f) % piece_size == 0
+			|| padded(fs, f) == padded(base_fs, bf);
+		for (int i = 0; i < num_pieces - (same_last ? 0 : 1); ++i) {
+			lt::piece_index_t::diff_type const d{i};
+			t.set_hash(first_piece + d, base.hash_for_piece(base_first + d));
+		}
+		if (!same_last) {
+			t.set_hash(first_piece + lt::piece_index_t::diff_type{num_pieces - 1}
+				, hash_last_piece(full_path, fs.file_size(f), piece_size, padded(fs, f)));
+		}
+	}
+
+	if (!quiet) {
+		for (auto const& f : base_files)
+			std::cout << "removed: " << f.first << '\n';
+		std::cout << unchanged << " unchanged, " << changed
+			<< " changed, " << new_files << " new, " << base_files.size() << " removed files\n";
+	}
+
+	hash_torrent_files(t, save_path, to_hash, opts);
+}
+
 } // anonymous namespace
 
 int main(int argc_, char const* argv_[]) try
@@ -133,6 +622,17 @@ int main(int argc_, char const* argv_[]) try
 	std::string root_cert;
 	bool quiet = false;
 	int num_threads = default_num_threads;
+	int hdd_depth = 1;
+	int ssd_depth = 4;
+	bool hdd = false;
+	bool reflinks = false;
+	std::string base_torrent;
+	bool use_stdin = false;
+	std::string stdin_name;
+	std::int64_t stdin_size = -1;
+	std::string tee_path;
+	std::string copy_to;
+	bool sidecar = false;
 
 	std::string output_file = "a.torrent";
 
@@ -146,6 +646,52 @@ int main(int argc_, char const* argv_[]) try
 			num_threads = atoi(args[1]);
 			args = args.subspan(1);
 		}
+		else if (args[0] == "--hdd"sv) {
+			hdd = true;
+		}
+		else if (args[0] == "--reflinks"sv) {
+			reflinks = true;
+		}
+		else if (args[0] == "--sidecar"sv) {
+			sidecar = true;
+		}
+		else if (args[0] == "--hdd-depth"sv && args.size() > 1) {
+			hdd_depth = std::max(1, atoi(args[1]));
+			args = args.subspan(1);
+		}
+		else if (args[0] == "--ssd-depth"sv && args.size() > 1) {
+			ssd_depth = std::max(1, atoi(args[1]));
+			args = args.subspan(1);
+		}
+		else if (args[0] == "--base"sv && args.size() > 1) {
+			base_torrent = args[1];
+			args = args.subspan(1);
+		}
+		else if (stats::parse_option(args[0])) {
+		}
+		else if (args[0] == "--stdin"sv) {
+			use_stdin = true;
+		}
+		else if (args[0] == "--name"sv && args.size() > 1) {
+			stdin_name = args[1];
+			args = args.subspan(1);
+		}
+		else if (args[0] == "--size"sv && args.size() > 1) {
+			stdin_size = std::atoll(args[1]);
+			args = args.subspan(1);
+			if (stdin_size <= 0) {
+				std::cerr << "invalid size: \"" << args[0] << "\"\n";
+				return 1;
+			}
+		}
+		else if (args[0] == "--tee"sv && args.size() > 1) {
+			tee_path = args[1];
+			args = args.subspan(1);
+		}
+		else if (args[0] == "--copy-to"sv && args.size() > 1) {
+			copy_to = args[1];
+			args = args.subspan(1);
+		}
 		else if ((args[0] == "-t"sv || args[0] == "--tracker"sv) && args.size() > 1) {
 			std::string t = args[1];
 			args = args.subspan(1);
@@ -224,18 +770,62 @@ int main(int argc_, char const* argv_[]) try
 		args = args.subspan(1);
 	}
 
-	if (args.empty()) {
+	lt::file_storage fs;
+	stream_hashes streamed;
+	if (use_stdin) {
+		if (!args.empty()) {
+			std::cerr << "--stdin does not take a file (\"" << args[0] << "\")\n";
+			return 1;
+		}
+		if (stdin_name.empty()) {
+			std::cerr << "--stdin requires --name\n";
+			return 1;
+		}
+		if (!base_torrent.empty()) {
+			std::cerr << "--base cannot be used with --stdin\n";
+			return 1;
+		}
+		if (!copy_to.empty()) {
+			std::cerr << "--copy-to cannot be used with --stdin (see --tee)\n";
+			return 1;
+		}
+		bool const v1 = !(flags & lt::create_torrent::v2_only);
+		if (stdin_size >= 0) {
+			fs.add_file(stdin_name, stdin_size);
+			// the piece size create_torrent picks, for the v1 hashes
+			if (piece_size == 0) piece_size = lt::create_torrent(fs, 0, flags).piece_length();
+		}
+		else if (v1 && piece_size == 0) {
+			std::cerr << "the piece size of content of unknown size must be specified "
+				"(-s), or the torrent be v2-only (-2)\n";
+			return 1;
+		}
+#ifdef TORRENT_WINDOWS
+		_setmode(_fileno(stdin), _O_BINARY);
+#endif
+		streamed = hash_stdin(v1 ? piece_size : 0, stdin_size, tee_path
+			, !quiet && stdout_is_tty());
+		if (stdin_size < 0) fs.add_file(stdin_name, streamed.size);
+	}
+	else if (!tee_path.empty() || !stdin_name.empty() || stdin_size >= 0) {
+		std::cerr << "--name, --size and --tee can only be used with --stdin\n";
+		return 1;
+	}
+	else if (!copy_to.empty() && !base_torrent.empty()) {
+		std::cerr << "--copy-to cannot be used with --base\n";
+		return 1;
+	}
+	else if (args.empty()) {
 		print_usage();
 		std::cerr << "no files specified.\n";
 		return 1;
 	}
-	std::string full_path = args[0];
+	std::string full_path = use_stdin ? std::string() : args[0];
 
-	lt::file_storage fs;
 #ifdef TORRENT_WINDOWS
-	if (full_path[1] != ':')
+	if (!use_stdin && full_path[1] != ':')
 #else
-	if (full_path[0] != '/')
+	if (!use_stdin && full_path[0] != '/')
 #endif
 	{
 		char cwd[2048];
@@ -260,12 +850,23 @@ int main(int argc_, char const* argv_[]) try
 #endif
 	}
 
-	lt::add_files(fs, full_path, file_filter, flags);
+	if (!use_stdin) {
+		stats::scoped_timer timer(stats::timer::stat);
+		lt::add_files(fs, full_path, file_filter, flags);
+	}
 	if (fs.num_files() == 0) {
 		std::cerr << "no files specified.\n";
 		return 1;
 	}
 
+	std::unique_ptr<lt::torrent_info> base;
+	if (!base_torrent.empty()) {
+		stats::scoped_timer timer(stats::timer::parse);
+		base = std::make_unique<lt::torrent_info>(base_torrent);
+		// to be able to reuse the hashes, the piece size must be the same
+		if (piece_size == 0) piece_size = base->piece_length();
+	}
+
 	lt::create_torrent t(fs, piece_size, flags);
 	int tier = 0;
 	if (!trackers.empty()) {
@@ -285,18 +886,26 @@ int main(int argc_, char const* argv_[]) try
 
 	t.set_priv(private_torrent);
 
-	lt::settings_pack sett;
-	sett.set_int(lt::settings_pack::hashing_threads, num_threads);
-	sett.set_int(lt::settings_pack::file_pool_size, 2);
-	auto const num = t.num_pieces();
-	lt::set_piece_hashes(t, branch_path(full_path), sett
-		, [num, quiet] (lt::piece_index_t const p) {
-			if (quiet) return;
-			std::cout << "\r" << (p + lt::piece_index_t::diff_type{1}) << "/" << num;
-			std::cout.flush();
-		});
-
-	if (!quiet) std::cerr << "\n";
+	hash_options const hash_opts{num_threads, hdd_depth, ssd_depth, hdd, quiet, copy_to
+		, reflinks};
+	if (use_stdin) {
+		set_stream_hashes(t, std::move(streamed));
+	}
+	else if (base) {
+		hash_from_base(t, *base, branch_path(full_path), hash_opts);
+	}
+	else {
+		lt::file_storage const& tfs = t.files();
+		if (!copy_to.empty()) prepare_copy(tfs, branch_path(full_path), copy_to);
+		std::vector<lt::file_index_t> files;
+		for (auto const f : tfs.file_range()) {
+			if (tfs.pad_file_at(f) || tfs.file_size(f) == 0) continue;
+			if (tfs.file_flags(f) & lt::file_storage::flag_symlink) continue;
+			files.push_back(f);
+		}
+		hash_torrent_files(t, branch_path(full_path), files, hash_opts);
+		if (!copy_to.empty()) finish_copy(tfs, branch_path(full_path), copy_to);
+	}
 	t.set_creator(creator.c_str());
 	if (!comment_str.empty()) {
 		t.set_comment(comment_str.c_str());
@@ -310,12 +919,20 @@ int main(int argc_, char const* argv_[]) try
 
 	// create the torrent and print it to stdout
 	std::vector<char> torrent;
-	lt::bencode(back_inserter(torrent), t.generate());
+	{
+		stats::scoped_timer timer(stats::timer::encode);
+		lt::bencode(back_inserter(torrent), t.generate());
+	}
 
+	stats::scoped_timer timer(stats::timer::write);
 	std::fstream out;
 	out.exceptions(std::ifstream::failbit);
 	out.open(output_file.c_str(), std::ios_base::out | std::ios_base::binary);
 	out.write(torrent.data(), int(torrent.size()));
+	stats::add(stats::counter::bytes_written, std::int64_t(torrent.size()));
+	timer.stop();
+
+	if (sidecar) save_sidecar(output_file + ".sidecar", torrent);
 
 	return 0;
 }
@@ -0,0 +1,141 @@
+/*
+
+Copyright (c) 2026, Arvid Norberg
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <string>
+#include <system_error>
+
+#if defined _WIN32
+#include <filesystem> // for resize_file
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// a file opened for writing. Like input_file, this uses plain file
+// descriptors on POSIX systems. Errors are reported as exceptions
+struct output_file
+{
+	output_file() = default;
+	output_file(output_file const&) = delete;
+	output_file& operator=(output_file const&) = delete;
+	~output_file()
+	{
+#if defined _WIN32
+		if (m_file.is_open()) m_file.close();
+#else
+		if (m_fd >= 0) ::close(m_fd);
+#endif
+	}
+
+	// opens "path" to write it from the start, truncating it if it exists
+	void open(std::string const& path)
+	{
+		close();
+#if defined _WIN32
+		m_file.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+		m_file.open(path.c_str(), std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+#else
+		m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+		if (m_fd < 0) throw std::system_error(errno, std::generic_category());
+#endif
+	}
+
+	// opens "path" for writing at arbitrary offsets, with write_at(), and sets
+	// its size to "size". It's not truncated, so that multiple threads (each
+	// with its own output_file) can write different parts of the same file
+	void open(std::string const& path, std::int64_t const size)
+	{
+		close();
+#if defined _WIN32
+		m_file.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+		// opening for reading too, is the only way to not truncate the file,
+		// but it also won't create it
+		{ std::ofstream create(path.c_str(), std::ios_base::app | std::ios_base::binary); }
+		std::filesystem::resize_file(path, std::uintmax_t(size));
+		m_file.open(path.c_str(), std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+#else
+		m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+		if (m_fd < 0) throw std::system_error(errno, std::generic_category());
+		if (::ftruncate(m_fd, off_t(size)) != 0) throw std::system_error(errno, std::generic_category());
+#endif
+	}
+
+	bool is_open() const
+	{
+#if defined _WIN32
+		return m_file.is_open();
+#else
+		return m_fd >= 0;
+#endif
+	}
+
+	// writes all of "len" bytes, at the end of what's been written so far
+	void write(char const* buf, std::int64_t len)
+	{
+#if defined _WIN32
+		m_file.write(buf, std::streamsize(len));
+#else
+		while (len > 0) {
+			ssize_t const ret = ::write(m_fd, buf, std::size_t(len));
+			if (ret < 0) {
+				if (errno == EINTR) continue;
+				throw std::system_error(errno, std::generic_category());
+			}
+			buf += ret;
+			len -= ret;
+		}
+#endif
+	}
+
+	// writes all of "len" bytes at "offset"
+	void write_at(std::int64_t offset, char const* buf, std::int64_t len)
+	{
+#if defined _WIN32
+		m_file.seekp(offset, std::ios_base::beg);
+		m_file.write(buf, std::streamsize(len));
+#else
+		while (len > 0) {
+			ssize_t const ret = ::pwrite(m_fd, buf, std::size_t(len), off_t(offset));
+			if (ret < 0) {
+				if (errno == EINTR) continue;
+				throw std::system_error(errno, std::generic_category());
+			}
+			buf += ret;
+			offset += ret;
+			len -= ret;
+		}
+#endif
+	}
+
+	// closes the file, reporting errors of writes that were deferred by the
+	// operating system
+	void close()
+	{
+#if defined _WIN32
+		if (m_file.is_open()) m_file.close();
+#else
+		if (m_fd < 0) return;
+		int const fd = m_fd;
+		m_fd = -1;
+		if (::close(fd) != 0) throw std::system_error(errno, std::generic_category());
+#endif
+	}
+
+private:
+#if defined _WIN32
+	std::ofstream m_file;
+#else
+	int m_fd = -1;
+#endif
+};
@@ -0,0 +1,49 @@
+/*
+
+Copyright (c) 2026, Arvid Norberg
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#pragma once
+
+#include "libtorrent/sha1_hash.hpp"
+#include "libtorrent/hasher.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+// v1 pieces of hybrid torrents end with the zeros of pad files. These are
+// never read from disk, nor written to a buffer, they're fed to the hasher from
+// a static block of zeros.
+
+// feeds "n" zero bytes to "h"
+inline void hash_zeros(lt::hasher& h, std::int64_t n)
+{
+	static char const zeros[0x4000] = {};
+	while (n > 0) {
+		int const len = int(std::min(n, std::int64_t(sizeof(zeros))));
+		h.update(zeros, len);
+		n -= len;
+	}
+}
+
+// the SHA-1 of "piece_size" zeros, i.e. of a v1 piece that's all padding.
+// The hash is computed once per piece size, and may be called from any thread
+inline lt::sha1_hash zero_piece_hash(int const piece_size)
+{
+	static std::mutex mutex;
+	static std::map<int, lt::sha1_hash> cache;
+	std::lock_guard<std::mutex> l(mutex);
+	auto it = cache.find(piece_size);
+	if (it == cache.end()) {
+		lt::hasher h;
+		hash_zeros(h, piece_size);
+		it = cache.emplace(piece_size, h.final()).first;
+	}
+	return it->second;
+}
@@ -12,6 +12,7 @@ see LICENSE file.
 #include <fstream>
 #include <iostream>
 #include <iomanip>
+#include <memory>
 #include <string_view>
 #include <variant>
 #include <time.h>
@@ -19,6 +20,8 @@ see LICENSE file.
 #include "libtorrent/torrent_info.hpp"
 #include "libtorrent/span.hpp"
 #include "common.hpp"
+#include "stats.hpp"
+#include "sidecar.hpp"
 
 #if defined _WIN32
 #include <io.h> // for _isatty
@@ -37,6 +40,8 @@ void print_usage()
 	std::cout << R"(usage: torrent-print [OPTIONS] torrent-files...
 
 -h, --help               Show this message
+--stats[=json]           Print where time was spent (parsing etc.) to stderr
+                         on exit
 
 PRINT OPTIONS:
 -f, --files              List files in torrent(s)
@@ -51,6 +56,8 @@ PRINT OPTIONS:
 --trackers               Print trackers
 --web-seeds              Print web-seeds
 --dht-nodes              Print DHT-nodes
+--piece-layers           Print the piece layer of each file (v2 torrents).
+                         Not included by default
 )"
 
 #if LIBTORRENT_VERSION_NUM >= 30000
@@ -78,6 +85,11 @@ PARSE OPTIONS:
 --max-pieces <count>     Set the upper limit on the number of pieces to
                          load in the torrent.
 --max-size <size>        Reject files larger than this size limit, specified in MB
+--use-sidecars           Take the piece layers of each torrent from its sidecar
+                         (<torrent-file>.sidecar, see torrent-new --sidecar)
+                         instead of parsing them from the torrent. The layers
+                         are printed as they are, without checking them
+                         against the file roots
 
 By default, all properties of torrents are printed. If any option is specified
 to print a specific property, only those specified are printed.
@@ -420,6 +432,8 @@ int main(int argc, char const* argv[]) try
 	bool print_trackers = false;
 	bool print_web_seeds = false;
 	bool print_dht_nodes = false;
+	bool print_piece_layers = false;
+	bool use_sidecars = false;
 #if LIBTORRENT_VERSION_NUM >= 30000
 	bool print_size_on_disk = false;
 #endif
@@ -499,6 +513,15 @@ int main(int argc, char const* argv[]) try
 			print_dht_nodes = true;
 			print_all = false;
 		}
+		else if (args[0] == "--piece-layers"sv)
+		{
+			print_piece_layers = true;
+			print_all = false;
+		}
+		else if (args[0] == "--use-sidecars"sv)
+		{
+			use_sidecars = true;
+		}
 #if LIBTORRENT_VERSION_NUM >= 30000
 		else if (args[0] == "--total-size"sv)
 		{
@@ -550,25 +573,11 @@ int main(int argc, char const* argv[]) try
 		{
 			print_file_mtime = true;
 		}
-		else if (args[0] == "--items-limit"sv && args.size() > 1)
-		{
-			cfg.max_decode_tokens = atoi(args[1]);
-			args = args.subspan(1);
-		}
-		else if (args[0] == "--depth-limit"sv && args.size() > 1)
+		else if (parse_load_limit(args, cfg))
 		{
-			cfg.max_decode_depth = atoi(args[1]);
-			args = args.subspan(1);
 		}
-		else if (args[0] == "--max-pieces"sv && args.size() > 1)
+		else if (stats::parse_option(args[0]))
 		{
-			cfg.max_pieces = atoi(args[1]);
-			args = args.subspan(1);
-		}
-		else if (args[0] == "--max-size"sv && args.size() > 1)
-		{
-			cfg.max_buffer_size = atoi(args[1]) * 1024 * 1024;
-			args = args.subspan(1);
 		}
 		else if (args[0] == "--show-padfiles"sv)
 		{
@@ -589,7 +598,16 @@ int main(int argc, char const* argv[]) try
 
 	for (auto const filename : args) {
 
-		lt::torrent_info const t(filename, cfg);
+		lt::torrent_info const t = [&] {
+			stats::scoped_timer timer(stats::timer::parse);
+			if (use_sidecars) return load_torrent_without_layers(filename, cfg);
+			return lt::torrent_info(filename, cfg);
+		}();
+		std::unique_ptr<sidecar const> side;
+		if (use_sidecars) {
+			side = std::make_unique<sidecar const>(std::string(filename) + ".sidecar");
+			side->check(t);
+		}
 
 		if (args.size() > 1) {
 			std::cout << filename << ":\n";
@@ -671,6 +689,20 @@ int main(int argc, char const* argv[]) try
 				print_file_list(st);
 			}
 		}
+
+		if (print_piece_layers && t.info_hashes().has_v2()) {
+			std::cout << "piece layers:\n";
+			lt::file_storage const& st = t.files();
+			for (auto const i : st.file_range())
+			{
+				if (st.pad_file_at(i)) continue;
+				// files of a single piece have their root as piece layer
+				auto const layer = side ? side->piece_layer(i) : t.piece_layer(i);
+				std::cout << st.file_path(i) << ":\n";
+				for (std::ptrdiff_t h = 0; h < layer.size(); h += lt::sha256_hash::size())
+					std::cout << "  " << lt::sha256_hash(layer.data() + h) << '\n';
+			}
+		}
 	}
 }
 catch (std::exception const& e)
@@ -0,0 +1,183 @@
+/*
+
+Copyright (c) 2026, Arvid Norberg
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#pragma once
+
+#include "common.hpp" // for format_size
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined _WIN32
+#include <io.h> // for _isatty
+#define isatty(x) _isatty(x)
+#define fileno(x) _fileno(x)
+#else
+#include <unistd.h> // for isatty
+#endif
+
+inline bool stdout_is_tty() { return isatty(fileno(stdout)) != 0; }
+
+// prints the progress of hashing to stdout. The hashing threads only bump
+// atomic counters, a separate thread prints them 10 times per second, along
+// with the throughput (total and per device), the ETA and the number of files
+// done. When disabled (e.g. stdout is not a terminal), nothing is printed and
+// no thread is started.
+struct progress_reporter
+{
+	progress_reporter(std::int64_t const total_bytes, int const total_files
+		, std::vector<std::string> devices, bool const enabled)
+		: m_total_bytes(total_bytes)
+		, m_total_files(total_files)
+		, m_devices(std::move(devices))
+		, m_device_bytes(new std::atomic<std::int64_t>[std::max(std::size_t(1), m_devices.size())])
+		, m_enabled(enabled)
+	{
+		for (std::size_t i = 0; i < std::max(std::size_t(1), m_devices.size()); ++i)
+			m_device_bytes[i] = 0;
+		if (!m_enabled) return;
+		m_thread = std::thread([this] { run(); });
+	}
+
+	progress_reporter(progress_reporter const&) = delete;
+	progress_reporter& operator=(progress_reporter const&) = delete;
+
+	~progress_reporter()
+	{
+		if (!m_enabled) return;
+		{
+			std::lock_guard<std::mutex> l(m_mutex);
+			m_stop = true;
+		}
+		m_cond.notify_one();
+		m_thread.join();
+	}
+
+	bool enabled() const { return m_enabled; }
+
+	// may be called concurrently, from any thread
+	void bytes_done(std::int64_t const n, int const device = 0)
+	{
+		if (!m_enabled) return;
+		m_bytes.fetch_add(n, std::memory_order_relaxed);
+		if (std::size_t(device) < m_devices.size())
+			m_device_bytes[std::size_t(device)].fetch_add(n, std::memory_order_relaxed);
+	}
+
+	void file_done()
+	{
+		if (!m_enabled) return;
+		m_files.fetch_add(1, std::memory_order_relaxed);
+	}
+
+private:
+
+	using clock = std::chrono::steady_clock;
+
+	void run()
+	{
+		auto const start = clock::now();
+		auto last = start;
+		std::int64_t last_bytes = 0;
+		std::vector<std::int64_t> last_device(m_devices.size(), 0);
+		// the rates are smoothed, to not have the line flicker
+		double rate = 0;
+		std::vector<double> device_rate(m_devices.size(), 0);
+		std::size_t line_len = 0;
+
+		std::unique_lock<std::mutex> l(m_mutex);
+		for (;;) {
+			bool const stop = m_cond.wait_for(l, std::chrono::milliseconds(100)
+				, [this] { return m_stop; });
+
+			auto const now = clock::now();
+			double const elapsed = std::chrono::duration<double>(now - last).count();
+			last = now;
+			auto const smooth = [elapsed](double& r, std::int64_t const delta) {
+				if (elapsed <= 0) return;
+				r = r == 0 ? double(delta) / elapsed : r * 0.7 + double(delta) / elapsed * 0.3;
+			};
+
+			std::int64_t const bytes = m_bytes.load(std::memory_order_relaxed);
+			smooth(rate, bytes - last_bytes);
+			last_bytes = bytes;
+
+			std::string line = format_size(bytes) + " / " + format_size(m_total_bytes)
+				+ "  " + format_size(std::int64_t(rate)) + "/s";
+			if (stop) {
+				double const total = std::chrono::duration<double>(now - start).count();
+				line += "  in " + format_time(total);
+			}
+			else if (rate > 0) {
+				line += "  ETA " + format_time(double(m_total_bytes - bytes) / rate);
+			}
+			line += "  files " + std::to_string(m_files.load(std::memory_order_relaxed))
+				+ "/" + std::to_string(m_total_files);
+
+			for (std::size_t i = 0; i < m_devices.size(); ++i) {
+				std::int64_t const b = m_device_bytes[i].load(std::memory_order_relaxed);
+				smooth(device_rate[i], b - last_device[i]);
+				last_device[i] = b;
+			}
+			// with a single device, its throughput is the same as the total
+			if (m_devices.size() > 1) {
+				line += "  [";
+				for (std::size_t i = 0; i < m_devices.size(); ++i) {
+					if (i > 0) line += ", ";
+					line += m_devices[i] + " " + format_size(std::int64_t(device_rate[i])) + "/s";
+				}
+				line += "]";
+			}
+
+			// overwrite all of the previous line
+			std::size_t const len = line.size();
+			if (len < line_len) line.append(line_len - len, ' ');
+			line_len = len;
+			std::cout << '\r' << line;
+			if (stop) std::cout << '\n';
+			std::cout.flush();
+			if (stop) break;
+		}
+	}
+
+	static std::string format_time(double const seconds)
+	{
+		auto const s = std::int64_t(seconds);
+		char buf[40];
+		if (s >= 3600)
+			std::snprintf(buf, sizeof(buf), "%d:%02d:%02d", int(s / 3600), int(s / 60 % 60), int(s % 60));
+		else
+			std::snprintf(buf, sizeof(buf), "%d:%02d", int(s / 60), int(s % 60));
+		return buf;
+	}
+
+	std::int64_t const m_total_bytes;
+	int const m_total_files;
+	std::vector<std::string> const m_devices;
+
+	std::atomic<std::int64_t> m_bytes{0};
+	std::atomic<int> m_files{0};
+	std::unique_ptr<std::atomic<std::int64_t>[]> m_device_bytes;
+
+	bool const m_enabled;
+	bool m_stop = false;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::thread m_thread;
+};
@@ -0,0 +1,194 @@
+/*
+
+Copyright (c) 2026, Arvid Norberg
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#pragma once
+
+#include "libtorrent/create_torrent.hpp"
+#include "libtorrent/file_storage.hpp"
+#include "libtorrent/hasher.hpp"
+#include "libtorrent/sha1_hash.hpp"
+#include "libtorrent/torrent_info.hpp"
+
+#include "stats.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// these are helpers to create a torrent from some of the files of another one
+// (possibly renamed), carrying over their hashes rather than hashing them
+// again. The v2 hashes are per file, so they can always be carried over. v1
+// pieces can be carried over as long as they contain the same data, at the
+// same alignment.
+
+lt::file_index_t const no_file{-1};
+
+// returns the piece in the input torrent whose content is identical to piece
+// "p" of the output torrent, or -1 if there is none. i.e. if the piece straddles
+// a file that was dropped, or it has been shifted to a different alignment.
+// "source" maps each file in the output to the file it came from in the input,
+// pad files that were inserted by create_torrent don't have a source.
+inline lt::piece_index_t source_piece(lt::file_storage const& out_fs
+	, lt::file_storage const& in_fs
+	, std::vector<lt::file_index_t> const& source
+	, lt::piece_index_t const p)
+{
+	int const piece_size = out_fs.piece_length();
+	int const len = out_fs.piece_size(p);
+	auto const slices = out_fs.map_block(p, 0, len);
+
+	// the offset of the data in the input torrent, relative to the output
+	std::optional<std::int64_t> delta;
+	for (auto const& s : slices) {
+		auto const src = source[std::size_t(static_cast<int>(s.file_index))];
+		if (s.size == 0 || src == no_file) continue;
+		std::int64_t const d = in_fs.file_offset(src) - out_fs.file_offset(s.file_index);
+		if (delta && *delta != d) return lt::piece_index_t{-1};
+		delta = d;
+	}
+	if (!delta || *delta % piece_size != 0) return lt::piece_index_t{-1};
+
+	std::int64_t const in_start = std::int64_t(static_cast<int>(p)) * piece_size + *delta;
+	lt::piece_index_t const q(int(in_start / piece_size));
+	if (in_start < 0 || q >= in_fs.end_piece() || in_fs.piece_size(q) != len)
+		return lt::piece_index_t{-1};
+
+	// any pad files inserted by create_torrent must line up with pad files in
+	// the input
+	for (auto const& s : slices) {
+		if (s.size == 0 || source[std::size_t(static_cast<int>(s.file_index))] != no_file)
+			continue;
+		std::int64_t const offset = out_fs.file_offset(s.file_index) + s.offset + *delta - in_start;
+		for (auto const& is : in_fs.map_block(q, offset, s.size)) {
+			if (!(in_fs.file_flags(is.file_index) & lt::file_storage::flag_pad_file))
+				return lt::piece_index_t{-1};
+		}
+	}
+	return q;
+}
+
+// computes the v1 hash of piece "p" of the output torrent, reading the file
+// data from "data_dir" (where the files are stored under their names in the
+// input torrent)
+inline lt::sha1_hash hash_v1_piece(lt::file_storage const& out_fs
+	, lt::file_storage const& in_fs
+	, std::vector<lt::file_index_t> const& source
+	, lt::piece_index_t const p
+	, std::string const& data_dir
+	, std::vector<char>& buf)
+{
+	lt::hasher h;
+	for (auto const& s : out_fs.map_block(p, 0, out_fs.piece_size(p))) {
+		buf.resize(std::size_t(s.size));
+		auto const src = source[std::size_t(static_cast<int>(s.file_index))];
+		if (src == no_file || out_fs.pad_file_at(s.file_index)) {
+			std::fill(buf.begin(), buf.end(), 0);
+		}
+		else {
+			std::string const path = in_fs.file_path(src, data_dir);
+			try {
+				std::fstream in;
+				in.exceptions(std::ifstream::failbit);
+				in.open(path.c_str(), std::ios_base::in | std::ios_base::binary);
+				stats::add(stats::counter::files_opened, 1);
+				in.seekg(s.offset, std::ios_base::beg);
+				stats::scoped_timer timer(stats::timer::read);
+				in.read(buf.data(), std::streamsize(buf.size()));
+				stats::add(stats::counter::bytes_read, std::int64_t(buf.size()));
+			}
+			catch (std::exception const& e) {
+				throw std::runtime_error("failed to read \"" + path + "\": " + e.what());
+			}
+		}
+		stats::scoped_timer timer(stats::timer::sha1);
+		h.update(buf.data(), int(buf.size()));
+	}
+	return h.final();
+}
+
+// maps the files of the new torrent, "out_fs", back to the files "keep" of the
+// input torrent it was created from. Unless it's v1-only, create_torrent may
+// have re-ordered the files and inserted pad files, so files are identified by
+// their root hash (which is stored by pointer). Empty files don't have one, but
+// they don't have any hashes either
+inline std::vector<lt::file_index_t> map_sources(lt::file_storage const& out_fs
+	, lt::file_storage const& in_fs
+	, std::vector<lt::file_index_t> const& keep
+	, bool const v1_only)
+{
+	std::vector<lt::file_index_t> source(std::size_t(out_fs.num_files()), no_file);
+	if (v1_only) {
+		std::copy(keep.begin(), keep.end(), source.begin());
+		return source;
+	}
+
+	std::unordered_map<char const*, lt::file_index_t> by_root;
+	for (auto f : keep) {
+		if (char const* r = in_fs.root_ptr(f)) by_root.emplace(r, f);
+	}
+	for (auto f : out_fs.file_range()) {
+		char const* r = out_fs.root_ptr(f);
+		if (r == nullptr) continue;
+		if (auto it = by_root.find(r); it != by_root.end())
+			source[std::size_t(static_cast<int>(f))] = it->second;
+	}
+	return source;
+}
+
+// sets the hashes of "t" from the "input" torrent, "source" maps the files of
+// "t" to the input files (see map_sources()). v1 pieces that can't be carried
+// over are hashed from "data_dir", unless it's empty, in which case that's an
+// error. If "t" is v2-only, the v1 hashes are ignored. "piece_layer" returns
+// the piece layer of an input file, as lt::torrent_info::piece_layer() does
+template <typename PieceLayer>
+void copy_hashes(lt::create_torrent& t, lt::torrent_info const& input
+	, std::vector<lt::file_index_t> const& source
+	, std::string const& data_dir
+	, PieceLayer const& piece_layer)
+{
+	lt::file_storage const& out_fs = t.files();
+	lt::file_storage const& input_fs = input.files();
+
+	if (input.info_hashes().has_v1() && !t.is_v2_only()) {
+		// pieces whose content is unchanged (possibly shifted by a whole number
+		// of pieces) are copied from the input. Only the pieces straddling the
+		// boundary of a dropped file need to be hashed again
+		std::vector<char> buf;
+		for (auto const p : out_fs.piece_range()) {
+			lt::piece_index_t const q = source_piece(out_fs, input_fs, source, p);
+			if (q >= lt::piece_index_t{0}) {
+				t.set_hash(p, input.hash_for_piece(q));
+				continue;
+			}
+			if (data_dir.empty()) {
+				throw std::runtime_error("piece " + std::to_string(static_cast<int>(p))
+					+ " needs to be hashed again, since files are not piece-aligned. "
+					"Specify where to find the files with --data-dir");
+			}
+			t.set_hash(p, hash_v1_piece(out_fs, input_fs, source, p, data_dir, buf));
+		}
+	}
+
+	if (input.info_hashes().has_v2()) {
+		for (auto f : out_fs.file_range()) {
+			auto const src = source[std::size_t(static_cast<int>(f))];
+			if (src == no_file || out_fs.pad_file_at(f))
+				continue;
+			auto const layer = piece_layer(src);
+			lt::piece_index_t::diff_type p{0};
+			for (int h = 0; h < int(layer.size()); h += int(lt::sha256_hash::size())) {
+				t.set_hash2(f, p++, lt::sha256_hash(layer.data() + h));
+			}
+		}
+	}
+}
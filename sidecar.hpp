@@ -0,0 +1,368 @@
+/*
+
+Copyright (c) 2026, Arvid Norberg
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#pragma once
+
+#include "libtorrent/torrent_info.hpp"
+#include "libtorrent/bdecode.hpp"
+#include "libtorrent/sha1_hash.hpp" // for sha256_hash
+#include "libtorrent/span.hpp"
+
+#include "common.hpp" // for load_file
+#include "merkle.hpp"
+#include "output_file.hpp"
+#include "splice.hpp"
+#include "stats.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if !defined _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// A sidecar holds the v2 hashes of a torrent (its file roots and piece layers)
+// in a binary form that can be memory mapped and used in place, rather than
+// bdecoding (and validating) the torrent's "piece layers", which is most of a
+// large v2 torrent. By convention, the sidecar of "a.torrent" is
+// "a.torrent.sidecar". All integers are little endian. The layout is:
+//
+//   header (64 bytes):
+//     char[8]  "TTSIDECR"
+//     u32      version (1)
+//     u32      piece size
+//     u64      number of files
+//     u64      number of layer hashes
+//     u8[32]   the v2 info-hash of the torrent
+//
+//   file table (64 bytes per file, in the order of the torrent, pad files
+//   included):
+//     u8[32]   pieces root (zeros for pad files and empty files)
+//     u64      file size
+//     u64      the index of the file's first hash among the layer hashes
+//     u64      the number of layer hashes of the file (0 for files that
+//              aren't larger than a piece, those don't have a piece layer)
+//     u64      flags (1 = pad file)
+//
+//   layer hashes (32 bytes each): the piece layers of all files, concatenated
+//
+// Every part is 32 byte aligned.
+
+namespace sidecar_detail {
+
+char const magic[8] = {'T', 'T', 'S', 'I', 'D', 'E', 'C', 'R'};
+std::uint32_t const version = 1;
+std::size_t const header_size = 64;
+std::size_t const file_entry_size = 64;
+std::size_t const hash_size = 32;
+std::uint64_t const flag_pad_file = 1;
+
+inline void write_le(std::vector<char>& out, std::uint64_t v, int const bytes)
+{
+	for (int i = 0; i < bytes; ++i) {
+		out.push_back(char(v & 0xff));
+		v >>= 8;
+	}
+}
+
+inline std::uint64_t read_le(char const* p, int const bytes)
+{
+	std::uint64_t ret = 0;
+	for (int i = bytes - 1; i >= 0; --i)
+		ret = (ret << 8) | static_cast<unsigned char>(p[i]);
+	return ret;
+}
+
+inline void write_hash(std::vector<char>& out, lt::sha256_hash const& h)
+{
+	out.insert(out.end(), h.data(), h.data() + h.size());
+}
+
+} // namespace sidecar_detail
+
+// builds the sidecar of the v2 (or hybrid) torrent "t"
+inline std::vector<char> make_sidecar(lt::torrent_info const& t)
+{
+	using namespace sidecar_detail;
+	if (!t.info_hashes().has_v2())
+		throw std::runtime_error("only v2 and hybrid torrents have a sidecar");
+
+	lt::file_storage const& fs = t.files();
+	int const piece_size = t.piece_length();
+	std::vector<char> files;
+	std::vector<char> layers;
+	std::uint64_t num_hashes = 0;
+	for (auto const f : fs.file_range()) {
+		bool const pad = fs.pad_file_at(f);
+		// files of a single piece have the root as their piece_layer()
+		std::uint64_t const n = fs.file_size(f) > piece_size && !pad
+			? std::uint64_t(t.piece_layer(f).size()) / hash_size : 0;
+		write_hash(files, pad ? lt::sha256_hash() : fs.root(f));
+		write_le(files, std::uint64_t(fs.file_size(f)), 8);
+		write_le(files, n > 0 ? num_hashes : 0, 8);
+		write_le(files, n, 8);
+		write_le(files, pad ? flag_pad_file : 0, 8);
+		if (n > 0) {
+			auto const layer = t.piece_layer(f);
+			layers.insert(layers.end(), layer.begin(), layer.end());
+			num_hashes += n;
+		}
+	}
+
+	std::vector<char> ret;
+	ret.reserve(header_size + files.size() + layers.size());
+	ret.insert(ret.end(), std::begin(magic), std::end(magic));
+	write_le(ret, version, 4);
+	write_le(ret, std::uint64_t(piece_size), 4);
+	write_le(ret, std::uint64_t(fs.num_files()), 8);
+	write_le(ret, num_hashes, 8);
+	write_hash(ret, t.info_hashes().v2);
+	ret.insert(ret.end(), files.begin(), files.end());
+	ret.insert(ret.end(), layers.begin(), layers.end());
+	return ret;
+}
+
+// writes the sidecar of the torrent "torrent" (bencoded) to "path"
+inline void save_sidecar(std::string const& path, lt::span<char const> torrent)
+{
+	// the torrent was just created by us, it doesn't need the limits that
+	// protect against malicious ones
+	lt::load_torrent_limits cfg;
+	cfg.max_buffer_size = std::numeric_limits<int>::max();
+	cfg.max_pieces = std::numeric_limits<int>::max();
+	cfg.max_decode_tokens = std::numeric_limits<int>::max();
+	std::vector<char> buf;
+	{
+		stats::scoped_timer timer(stats::timer::encode);
+		buf = make_sidecar(lt::torrent_info(torrent, cfg, lt::from_span));
+	}
+
+	stats::scoped_timer timer(stats::timer::write);
+	try {
+		output_file out;
+		out.open(path);
+		out.write(buf.data(), std::int64_t(buf.size()));
+		out.close();
+	}
+	catch (std::exception const& e) {
+		throw std::runtime_error("failed to write \"" + path + "\": " + e.what());
+	}
+	stats::add(stats::counter::bytes_written, std::int64_t(buf.size()));
+}
+
+// returns the bencoded torrent "buf" without its "piece layers", for it to be
+// loaded without parsing them, when they're taken from a sidecar instead
+inline std::vector<char> strip_piece_layers(lt::span<char const> buf
+	, lt::load_torrent_limits const& cfg)
+{
+	lt::bdecode_node const n = lt::bdecode(buf, cfg.max_decode_depth, cfg.max_decode_tokens);
+	if (n.type() != lt::bdecode_node::dict_t || !n.dict_find("piece layers"))
+		return std::vector<char>(buf.begin(), buf.end());
+	lt::entry::dictionary_type remove;
+	remove["piece layers"];
+	std::vector<char> ret;
+	ret.reserve(std::size_t(buf.size()));
+	splice_dict(ret, n, remove, [](std::string_view, lt::bdecode_node const&, lt::entry const&) {});
+	return ret;
+}
+
+// loads the torrent "path" without its piece layers. Checking each piece layer
+// against its file's root is most of the work of loading a large v2 torrent,
+// the sidecar's piece layers are used instead
+inline lt::torrent_info load_torrent_without_layers(std::string const& path
+	, lt::load_torrent_limits const& cfg)
+{
+	std::vector<char> const file = load_file(path);
+	if (file.size() > std::size_t(cfg.max_buffer_size))
+		throw std::runtime_error("torrent file too large: \"" + path + "\"");
+	std::vector<char> const buf = strip_piece_layers(file, cfg);
+	return lt::torrent_info(buf, cfg, lt::from_span);
+}
+
+// a sidecar file, memory mapped (or read, where that's not supported)
+struct sidecar
+{
+	explicit sidecar(std::string const& path)
+	{
+		stats::scoped_timer timer(stats::timer::parse);
+#if defined _WIN32
+		m_buf = load_file(path);
+		m_data = m_buf.data();
+		m_size = m_buf.size();
+#else
+		int const fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) throw_error(path, std::strerror(errno));
+		struct stat st;
+		if (::fstat(fd, &st) != 0) {
+			::close(fd);
+			throw_error(path, std::strerror(errno));
+		}
+		m_size = std::size_t(st.st_size);
+		if (m_size > 0) {
+			void* const p = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+			if (p == MAP_FAILED) {
+				::close(fd);
+				throw_error(path, std::strerror(errno));
+			}
+			m_data = static_cast<char const*>(p);
+		}
+		::close(fd);
+#endif
+		validate(path);
+	}
+
+	sidecar(sidecar const&) = delete;
+	sidecar& operator=(sidecar const&) = delete;
+
+	~sidecar()
+	{
+#if !defined _WIN32
+		if (m_data != nullptr) ::munmap(const_cast<char*>(m_data), m_size);
+#endif
+	}
+
+	int piece_size() const
+	{
+		return int(sidecar_detail::read_le(m_data + 12, 4));
+	}
+
+	int num_files() const { return int(m_num_files); }
+
+	lt::sha256_hash info_hash() const { return lt::sha256_hash(m_data + 32); }
+
+	lt::sha256_hash root(lt::file_index_t const f) const
+	{
+		return lt::sha256_hash(entry(f));
+	}
+
+	// the piece layer of file "f", as 32 byte hashes. Like
+	// lt::torrent_info::piece_layer(), this is the root for files that aren't
+	// larger than a piece, and empty for pad files and empty files
+	lt::span<char const> piece_layer(lt::file_index_t const f) const
+	{
+		using namespace sidecar_detail;
+		char const* e = entry(f);
+		std::uint64_t const n = read_le(e + 48, 8);
+		if (n == 0) {
+			if (read_le(e + 32, 8) == 0 || (read_le(e + 56, 8) & flag_pad_file)) return {};
+			return {e, std::ptrdiff_t(hash_size)};
+		}
+		return {layers() + read_le(e + 40, 8) * hash_size, std::ptrdiff_t(n * hash_size)};
+	}
+
+	// throws if this is not the sidecar of "t", or if any of its file entries
+	// doesn't match the torrent's file (in size, root or the number of hashes
+	// in its piece layer)
+	void check(lt::torrent_info const& t) const
+	{
+		using namespace sidecar_detail;
+		if (!t.info_hashes().has_v2() || t.info_hashes().v2 != info_hash()
+			|| t.num_files() != num_files() || t.piece_length() != piece_size())
+			throw std::runtime_error("the sidecar \"" + m_path + "\" is not for this torrent");
+
+		lt::file_storage const& fs = t.files();
+		std::int64_t const piece_len = t.piece_length();
+		for (auto const f : fs.file_range()) {
+			char const* e = entry(f);
+			std::int64_t const size = fs.file_size(f);
+			bool const pad = fs.pad_file_at(f);
+			std::uint64_t const n = size > piece_len && !pad
+				? std::uint64_t((size + piece_len - 1) / piece_len) : 0;
+			if (read_le(e + 32, 8) != std::uint64_t(size)
+				|| bool(read_le(e + 56, 8) & flag_pad_file) != pad
+				|| read_le(e + 48, 8) != n
+				|| (!pad && size > 0 && root(f) != fs.root(f))) {
+				throw std::runtime_error("the sidecar \"" + m_path + "\" does not match file "
+					+ std::to_string(static_cast<int>(f)) + " of the torrent");
+			}
+		}
+	}
+
+	// throws if the piece layer of any file doesn't hash up to the file's root.
+	// check() only compares the shape of the layers with the torrent. This is
+	// a pass of SHA-256 over the layers, still much cheaper than bdecoding
+	// them. Call it before using the layers for anything but printing them
+	void check_layers(lt::torrent_info const& t) const
+	{
+		using namespace sidecar_detail;
+		int const pad_level = merkle_depth(std::size_t(t.piece_length() / merkle_block_size));
+		for (auto const f : t.files().file_range()) {
+			std::uint64_t const n = read_le(entry(f) + 48, 8);
+			if (n == 0) continue;
+			char const* layer = piece_layer(f).data();
+			merkle_builder b(pad_level);
+			for (std::uint64_t i = 0; i < n; ++i)
+				b.add(lt::sha256_hash(layer + i * hash_size));
+			if (b.root(merkle_num_leafs(std::size_t(n))) != root(f)) {
+				throw std::runtime_error("the piece layer of file " + std::to_string(static_cast<int>(f))
+					+ " in the sidecar \"" + m_path + "\" does not match its root");
+			}
+		}
+	}
+
+private:
+
+	[[noreturn]] static void throw_error(std::string const& path, std::string const& msg)
+	{
+		throw std::runtime_error("failed to load sidecar \"" + path + "\": " + msg);
+	}
+
+	char const* entry(lt::file_index_t const f) const
+	{
+		return m_data + sidecar_detail::header_size
+			+ std::size_t(static_cast<int>(f)) * sidecar_detail::file_entry_size;
+	}
+
+	char const* layers() const
+	{
+		return m_data + sidecar_detail::header_size + m_num_files * sidecar_detail::file_entry_size;
+	}
+
+	// checks that the header, and all file entries, are consistent with the
+	// size of the file, so they can be read without going out of bounds.
+	// Whether they match the torrent is up to check()
+	void validate(std::string const& path)
+	{
+		using namespace sidecar_detail;
+		m_path = path;
+		if (m_size < header_size || std::memcmp(m_data, magic, sizeof(magic)) != 0)
+			throw_error(path, "not a sidecar");
+		if (read_le(m_data + 8, 4) != version)
+			throw_error(path, "unsupported version");
+		std::uint64_t const files = read_le(m_data + 16, 8);
+		std::uint64_t const hashes = read_le(m_data + 24, 8);
+		if (files > (m_size - header_size) / file_entry_size
+			|| hashes > (m_size - header_size - files * file_entry_size) / hash_size
+			|| header_size + files * file_entry_size + hashes * hash_size != m_size)
+			throw_error(path, "invalid size");
+		m_num_files = std::size_t(files);
+		for (std::size_t i = 0; i < m_num_files; ++i) {
+			char const* e = m_data + header_size + i * file_entry_size;
+			std::uint64_t const first = read_le(e + 40, 8);
+			std::uint64_t const n = read_le(e + 48, 8);
+			if (first > hashes || n > hashes - first)
+				throw_error(path, "invalid piece layer of file " + std::to_string(i));
+		}
+	}
+
+	std::string m_path;
+#if defined _WIN32
+	std::vector<char> m_buf;
+#endif
+	char const* m_data = nullptr;
+	std::size_t m_size = 0;
+	std::size_t m_num_files = 0;
+};
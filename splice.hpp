@@ -0,0 +1,82 @@
+/*
+
+Copyright (c) 2026, Arvid Norberg
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#pragma once
+
+#include "libtorrent/bdecode.hpp"
+#include "libtorrent/bencode.hpp"
+#include "libtorrent/entry.hpp"
+
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// these are helpers to produce a bencoded buffer by copying parts of an
+// existing one verbatim, splicing in new or modified entries. This avoids
+// round-tripping the whole torrent through lt::entry.
+
+// appends "str" as a bencoded string
+inline void write_string(std::vector<char>& out, std::string_view const str)
+{
+	std::string const len = std::to_string(str.size());
+	out.insert(out.end(), len.begin(), len.end());
+	out.push_back(':');
+	out.insert(out.end(), str.begin(), str.end());
+}
+
+// appends the original bencoded representation of "n"
+inline void write_node(std::vector<char>& out, lt::bdecode_node const& n)
+{
+	auto const s = n.data_section();
+	out.insert(out.end(), s.begin(), s.end());
+}
+
+inline void write_entry(std::vector<char>& out, lt::entry const& e)
+{
+	lt::bencode(std::back_inserter(out), e);
+}
+
+// writes the dictionary "orig" with the entries from "add" inserted at their
+// (sorted) positions. For keys that exist in both, "conflict" is called with
+// the key, the original value and the new value, and is expected to write the
+// value to "out". Keys whose value in "add" is undefined (a default
+// constructed entry) are removed.
+template <typename Conflict>
+void splice_dict(std::vector<char>& out, lt::bdecode_node const& orig
+	, lt::entry::dictionary_type const& add, Conflict&& conflict)
+{
+	auto const write_added = [&](lt::entry::dictionary_type::const_iterator const i) {
+		if (i->second.type() == lt::entry::undefined_t) return;
+		write_string(out, i->first);
+		write_entry(out, i->second);
+	};
+
+	out.push_back('d');
+	auto it = add.begin();
+	for (int i = 0; i < orig.dict_size(); ++i) {
+		auto const [key, value] = orig.dict_at(i);
+		for (; it != add.end() && std::string_view(it->first) < key; ++it)
+			write_added(it);
+		if (it != add.end() && std::string_view(it->first) == key) {
+			if (it->second.type() != lt::entry::undefined_t) {
+				write_string(out, key);
+				conflict(key, value, it->second);
+			}
+			++it;
+		}
+		else {
+			write_string(out, key);
+			write_node(out, value);
+		}
+	}
+	for (; it != add.end(); ++it)
+		write_added(it);
+	out.push_back('e');
+}
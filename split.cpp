@@ -0,0 +1,475 @@
+/*
+
+Copyright (c) 2026, Arvid Norberg
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#include "libtorrent/bencode.hpp"
+#include "libtorrent/create_torrent.hpp"
+#include "libtorrent/torrent_info.hpp"
+#include "libtorrent/span.hpp"
+
+#include "common.hpp"
+#include "restructure.hpp"
+#include "sidecar.hpp"
+#include "stats.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace std::string_view_literals;
+
+namespace {
+
+int const default_num_threads
+	= std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+void print_usage()
+{
+	std::cout << R"(USAGE: torrent-split [OPTIONS] torrent-file
+OPTIONS:
+-o, --out-dir <dir>       Write the resulting torrents to <dir>. Defaults to
+                          the current directory.
+--depth <n>               Split by directory. All files under the same
+                          directory <n> levels below the root of the torrent
+                          go in the same torrent, named after the directory.
+                          Files closer to the root go with the other files in
+                          their directory, the ones in the root in a torrent
+                          by the original name.
+--target-size <size>      Split torrents larger than <size> bytes into
+                          several, in file order. Sizes may have a k, m or g
+                          suffix. A file larger than <size> is put in a
+                          torrent of its own.
+--max-files <n>           Split torrents with more than <n> files into several,
+                          in file order.
+-2, --v2-only             Make the resulting torrents v2-only, when splitting
+                          a hybrid torrent.
+--data-dir <dir>          The directory the torrent's files are stored in (i.e.
+                          the save path). v1 pieces that are not aligned the
+                          same way in the resulting torrent (at least the last
+                          piece of each, for hybrid torrents) are hashed again,
+                          reading data from here.
+--threads <n>             Create <n> torrents at a time. Defaults to )"
+	<< default_num_threads << R"(.
+--sidecar                 Also write the file roots and piece layers of each
+                          resulting torrent to <out>.sidecar (see torrent-new
+                          --sidecar)
+--use-sidecars            Take the piece layers of the input torrent from its
+                          sidecar (<torrent-file>.sidecar) instead of parsing
+                          them. They are still checked against the file roots
+--stats[=json]            Print where time was spent (parsing, reading,
+                          hashing, writing etc.) to stderr on exit
+-h, --help                Show this message
+-q                        Quiet, do not print log messages
+
+PARSE OPTIONS:
+--items-limit <count>     Set the upper limit of the number of bencode items
+                          in the torrent file.
+--depth-limit <count>     Set the recursion limit in the bdecoder
+--max-pieces <count>      Set the upper limit on the number of pieces to
+                          load in the torrent.
+--max-size <size>         Reject files larger than this size limit, specified
+                          in MB
+
+Splits a torrent into several smaller ones, according to the rules above. This
+is the opposite of torrent-merge. The v2 hashes of each file are carried over,
+so v2 torrents are split without reading any file data.
+
+The resulting torrents are named after the directory they were split by, with
+"/" replaced by "-" (or by the name of the input), and a "-<n>" suffix when
+split further by size or number of files. Trackers, DHT nodes, the comment,
+creator, creation date and private flag are carried over. Web seeds are only
+carried over to torrents that keep the original name, and symlinks only if they
+point inside the resulting torrent.
+)";
+}
+
+struct split_options
+{
+	int depth = 0;
+	std::int64_t max_size = 0;
+	int max_files = 0;
+	bool v2_only = false;
+	std::string data_dir;
+	bool quiet = false;
+};
+
+// the files of the input torrent that make up one of the resulting torrents
+struct split_torrent
+{
+	// the file name of the torrent, relative to the output directory
+	std::string filename;
+
+	// the number of characters of the input's file paths that are replaced
+	// by the name of this torrent. i.e. the part of the path above the
+	// directory it was split by
+	std::size_t prefix_len = 0;
+
+	std::vector<lt::file_index_t> files;
+	std::int64_t size = 0;
+};
+
+// the directory "path" (a file path in the input torrent) is split by, as a
+// pair of the offset of its name and the offset of the end of it. Both are 0
+// if the file is closer to the root than "depth" (or the torrent has a single
+// file)
+std::pair<std::size_t, std::size_t> split_directory(std::string const& path, int const depth)
+{
+	std::size_t end = path.find_first_of("/\\");
+	if (end == std::string::npos) return {0, 0};
+	std::size_t name = 0;
+	for (int i = 0; i < depth; ++i) {
+		// the last element is the file name, which is never split by
+		std::size_t const next = path.find_first_of("/\\", end + 1);
+		if (next == std::string::npos) break;
+		name = end + 1;
+		end = next;
+	}
+	if (name == 0) return {0, 0};
+	return {name, end};
+}
+
+// creates the torrent "out", from the files of "input"
+std::vector<char> make_split_torrent(split_options const& opts
+	, lt::torrent_info const& input, sidecar const* side, split_torrent const& out)
+{
+	lt::file_storage const& input_fs = input.files();
+	bool const v1_only = !input.info_hashes().has_v2();
+	bool const v2_only = !input.info_hashes().has_v1() || opts.v2_only;
+
+	// moves a path of the input torrent to be under the name of this torrent
+	auto const relocate = [&](std::string const& path) { return path.substr(out.prefix_len); };
+
+	// symlinks can only be kept if they point to one of the files of this
+	// torrent, or a directory containing any of them. Other parts of the
+	// input may have been split off into other torrents
+	auto const is_symlink = [&](lt::file_index_t const f) {
+		return bool(input_fs.file_flags(f) & lt::file_storage::flag_symlink);
+	};
+	std::set<std::string> inside;
+	if (std::any_of(out.files.begin(), out.files.end(), is_symlink)) {
+		for (auto const f : out.files) {
+			// the file, and every directory it's in, up to the root of this
+			// torrent
+			std::string path = input_fs.file_path(f);
+			while (inside.insert(path).second) {
+				std::size_t const sep = path.find_last_of("/\\");
+				if (sep == std::string::npos || sep < out.prefix_len) break;
+				path.resize(sep);
+			}
+		}
+	}
+	auto const symlink_inside = [&](lt::file_index_t const f) {
+		return !is_symlink(f) || inside.count(input_fs.symlink(f)) > 0;
+	};
+
+	// the input files to keep. Like torrent-modify, for v1-only torrents the
+	// pad files following each file (except the last) are kept, to keep as many
+	// pieces aligned as possible
+	std::vector<lt::file_index_t> keep;
+	for (auto const f : out.files) {
+		if (!symlink_inside(f)) {
+			if (!opts.quiet) std::cout << "ignoring " << input_fs.file_path(f) << " (symlink out of the torrent)\n";
+			continue;
+		}
+		keep.push_back(f);
+		lt::file_index_t const next(static_cast<int>(f) + 1);
+		if (v1_only && next < input_fs.end_file() && input_fs.pad_file_at(next))
+			keep.push_back(next);
+	}
+	while (!keep.empty() && input_fs.pad_file_at(keep.back())) keep.pop_back();
+	if (keep.empty())
+		throw std::runtime_error("no files left in " + out.filename);
+
+	lt::file_storage fs;
+	fs.set_piece_length(input.piece_length());
+	std::string name;
+	std::string path;
+	for (auto const f : keep) {
+		lt::file_flags_t const file_flags = input_fs.file_flags(f);
+		if (file_flags & lt::file_storage::flag_pad_file) {
+			path = name + "/.pad/" + std::to_string(input_fs.file_size(f));
+			fs.add_file(path, input_fs.file_size(f), file_flags);
+			continue;
+		}
+
+		path = relocate(input_fs.file_path(f));
+		if (name.empty()) name = path.substr(0, path.find_first_of("/\\"));
+
+		std::string const symlink_path
+			= file_flags & lt::file_storage::flag_symlink
+			? relocate(input_fs.symlink(f)) : std::string();
+
+		// the file names are borrowed from the input torrent
+		fs.add_file_borrow(input_fs.file_name(f), path, input_fs.file_size(f), file_flags, nullptr
+			, input_fs.mtime(f), symlink_path, input_fs.root_ptr(f));
+	}
+
+	lt::create_flags_t flags = lt::create_torrent::modification_time
+		| lt::create_torrent::symlinks;
+	if (v1_only) flags |= lt::create_torrent::v1_only;
+	if (v2_only) flags |= lt::create_torrent::v2_only;
+	lt::create_torrent t(fs, input.piece_length(), flags);
+
+	// map the files of the new torrent back to the input files
+	std::vector<lt::file_index_t> const source = map_sources(t.files(), input_fs, keep, v1_only);
+
+	if (!input.comment().empty()) t.set_comment(input.comment().c_str());
+	if (!input.creator().empty()) t.set_creator(input.creator().c_str());
+	t.set_creation_date(input.creation_date());
+	if (!input.ssl_cert().empty()) t.set_root_cert(input.ssl_cert());
+	for (auto const& tr : input.trackers())
+		t.add_tracker(tr.url, tr.tier);
+	// web seeds refer to the files by the name of the torrent
+	if (out.prefix_len == 0) {
+		for (auto const& ws : input.web_seeds())
+			t.add_url_seed(ws.url);
+	}
+	for (auto const& n : input.nodes())
+		t.add_node(n);
+	t.set_priv(input.priv());
+
+	copy_hashes(t, input, source, opts.data_dir, [&](lt::file_index_t const f) {
+		return side ? side->piece_layer(f) : input.piece_layer(f); });
+
+	stats::scoped_timer timer(stats::timer::encode);
+	std::vector<char> torrent;
+	lt::bencode(back_inserter(torrent), t.generate());
+	return torrent;
+}
+
+void save_file(std::string const& filename, std::vector<char> const& buf)
+{
+	stats::scoped_timer timer(stats::timer::write);
+	std::fstream out;
+	out.exceptions(std::ifstream::failbit);
+	out.open(filename.c_str(), std::ios_base::out | std::ios_base::binary);
+	out.write(buf.data(), int(buf.size()));
+	stats::add(stats::counter::bytes_written, std::int64_t(buf.size()));
+}
+
+} // anonymous namespace
+
+int main(int argc_, char const* argv_[]) try
+{
+	lt::span<char const*> args(argv_, argc_);
+	// strip executable name
+	args = args.subspan(1);
+
+	split_options opts;
+	lt::load_torrent_limits cfg;
+	std::string out_dir = ".";
+	int num_threads = default_num_threads;
+	bool sidecar_out = false;
+	bool use_sidecars = false;
+
+	if (args.empty()) {
+		print_usage();
+		return 1;
+	}
+
+	while (!args.empty() && args[0][0] == '-') {
+
+		if ((args[0] == "-o"sv || args[0] == "--out-dir"sv) && args.size() > 1) {
+			out_dir = args[1];
+			args = args.subspan(1);
+		}
+		else if (args[0] == "--depth"sv && args.size() > 1) {
+			opts.depth = atoi(args[1]);
+			args = args.subspan(1);
+			if (opts.depth <= 0) {
+				std::cerr << "invalid depth: \"" << args[0] << "\"\n";
+				return 1;
+			}
+		}
+		else if (args[0] == "--target-size"sv && args.size() > 1) {
+			opts.max_size = parse_size(args[1]);
+			args = args.subspan(1);
+			if (opts.max_size <= 0) {
+				std::cerr << "invalid size: \"" << args[0] << "\"\n";
+				return 1;
+			}
+		}
+		else if (args[0] == "--max-files"sv && args.size() > 1) {
+			opts.max_files = atoi(args[1]);
+			args = args.subspan(1);
+			if (opts.max_files <= 0) {
+				std::cerr << "invalid number of files: \"" << args[0] << "\"\n";
+				return 1;
+			}
+		}
+		else if (args[0] == "-2"sv || args[0] == "--v2-only"sv) {
+			opts.v2_only = true;
+		}
+		else if (args[0] == "--data-dir"sv && args.size() > 1) {
+			opts.data_dir = args[1];
+			args = args.subspan(1);
+		}
+		else if (args[0] == "--threads"sv && args.size() > 1) {
+			num_threads = atoi(args[1]);
+			args = args.subspan(1);
+		}
+		else if (args[0] == "--sidecar"sv) {
+			sidecar_out = true;
+		}
+		else if (args[0] == "--use-sidecars"sv) {
+			use_sidecars = true;
+		}
+		else if (args[0] == "-q"sv) {
+			opts.quiet = true;
+		}
+		else if (parse_load_limit(args, cfg)) {
+		}
+		else if (stats::parse_option(args[0])) {
+		}
+		else if (args[0] == "-h"sv || args[0] == "--help"sv) {
+			print_usage();
+			return 0;
+		}
+		else {
+			std::cerr << "unknown option " << args[0] << '\n';
+			print_usage();
+			return 1;
+		}
+		args = args.subspan(1);
+	}
+
+	if (args.size() != 1) {
+		print_usage();
+		return 1;
+	}
+
+	if (opts.depth == 0 && opts.max_size == 0 && opts.max_files == 0) {
+		std::cerr << "no split rule specified (--depth, --target-size or --max-files)\n";
+		return 1;
+	}
+
+	std::string const filename = args[0];
+	lt::torrent_info const input = [&] {
+		stats::scoped_timer timer(stats::timer::parse);
+		if (use_sidecars) return load_torrent_without_layers(filename, cfg);
+		return lt::torrent_info(filename, cfg);
+	}();
+	std::unique_ptr<sidecar const> side;
+	if (use_sidecars) {
+		side = std::make_unique<sidecar const>(filename + ".sidecar");
+		side->check(input);
+		side->check_layers(input);
+	}
+	lt::file_storage const& input_fs = input.files();
+
+	if (opts.v2_only && !input.info_hashes().has_v2())
+		throw std::runtime_error("v1-only torrents cannot be made v2-only");
+
+	// group the files by the directory they're split by, in a single pass
+	// over the input. The key is the path of the directory, below the root
+	std::map<std::string, split_torrent> groups;
+	for (auto const f : input_fs.file_range()) {
+		if (input_fs.pad_file_at(f)) continue;
+		std::string const path = input_fs.file_path(f);
+		auto const [name, end] = split_directory(path, opts.depth);
+		std::size_t const root_end = path.find_first_of("/\\");
+		std::string key = name == 0 ? std::string()
+			: path.substr(root_end + 1, end - root_end - 1);
+		auto& g = groups[std::move(key)];
+		g.prefix_len = name;
+		g.files.push_back(f);
+		g.size += input_fs.file_size(f);
+	}
+
+	// then split the groups further, by size and number of files
+	std::vector<split_torrent> outputs;
+	for (auto& [key, g] : groups) {
+		std::string stem = key.empty() ? input.name() : key;
+		std::replace(stem.begin(), stem.end(), '/', '-');
+		std::replace(stem.begin(), stem.end(), '\\', '-');
+
+		std::size_t const first = outputs.size();
+		for (auto const f : g.files) {
+			std::int64_t const size = input_fs.file_size(f);
+			if (outputs.size() == first
+				|| (opts.max_files > 0 && int(outputs.back().files.size()) >= opts.max_files)
+				|| (opts.max_size > 0 && outputs.back().size + size > opts.max_size))
+			{
+				auto& out = outputs.emplace_back();
+				out.filename = stem;
+				out.prefix_len = g.prefix_len;
+			}
+			outputs.back().files.push_back(f);
+			outputs.back().size += size;
+		}
+		if (outputs.size() - first > 1) {
+			for (std::size_t i = first; i < outputs.size(); ++i)
+				outputs[i].filename += "-" + std::to_string(i - first + 1);
+		}
+	}
+
+	std::set<std::string> names;
+	for (auto& out : outputs) {
+		out.filename += ".torrent";
+		if (!names.insert(out.filename).second)
+			throw std::runtime_error("more than one torrent would be named \"" + out.filename + "\"");
+	}
+
+	if (!opts.quiet) std::cout << "splitting " << filename << " into " << outputs.size() << " torrents\n";
+
+	std::filesystem::create_directories(out_dir);
+
+	// all torrents are created in parallel, from the same (immutable) input
+	std::atomic<std::size_t> next{0};
+	std::mutex mutex;
+	std::exception_ptr error;
+	auto worker = [&] {
+		for (;;) {
+			std::size_t const i = next++;
+			if (i >= outputs.size()) break;
+			auto const& out = outputs[i];
+			try {
+				std::vector<char> const torrent = make_split_torrent(opts, input, side.get(), out);
+				std::string const path = (std::filesystem::path(out_dir) / out.filename).string();
+				save_file(path, torrent);
+				if (sidecar_out) save_sidecar(path + ".sidecar", torrent);
+				if (!opts.quiet) {
+					std::lock_guard<std::mutex> l(mutex);
+					std::cout << "-> " << path << " (" << out.files.size() << " files, "
+						<< format_size(out.size) << ")\n";
+				}
+			}
+			catch (std::exception const& e) {
+				std::lock_guard<std::mutex> l(mutex);
+				if (!error) error = std::make_exception_ptr(std::runtime_error(out.filename + ": " + e.what()));
+				next = outputs.size();
+			}
+		}
+	};
+
+	int const threads = std::max(1, std::min(num_threads, int(outputs.size())));
+	std::vector<std::thread> pool;
+	for (int i = 1; i < threads; ++i) pool.emplace_back(worker);
+	worker();
+	for (auto& t : pool) t.join();
+	if (error) std::rethrow_exception(error);
+
+	return 0;
+}
+catch (std::exception const& e)
+{
+	std::cerr << "ERROR: " << e.what() << '\n';
+	return 1;
+}
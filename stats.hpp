@@ -0,0 +1,246 @@
+/*
+
+Copyright (c) 2026, Arvid Norberg
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#pragma once
+
+// instrumentation of where the tools spend their time, enabled by --stats.
+// When disabled, timers and counters cost a single branch.
+//
+// Allocations are counted by the replacement of the global operator new and
+// delete in stats_alloc.cpp, which the tools with --stats link. Without it,
+// the allocation counters stay at 0.
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string_view>
+
+#if defined _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h> // for GetProcessMemoryInfo
+#else
+#include <sys/resource.h> // for getrusage
+#endif
+
+namespace stats {
+
+enum class timer
+{
+	// loading and parsing .torrent files
+	parse,
+	// listing directories and stat()ing files
+	stat,
+	// reading file content
+	read,
+	sha1,
+	sha256,
+	// bencoding torrents
+	encode,
+	// writing .torrent files
+	write,
+	num_timers
+};
+
+enum class counter
+{
+	bytes_read,
+	bytes_written,
+	files_opened,
+	allocations,
+	allocated_bytes,
+	num_counters
+};
+
+namespace detail {
+
+using clock = std::chrono::steady_clock;
+
+char const* const timer_names[] = {"parse", "stat", "read", "sha1", "sha256", "encode", "write"};
+char const* const counter_names[] = {"bytes-read", "bytes-written", "files-opened"
+	, "allocations", "allocated-bytes"};
+
+// read latencies are recorded in power-of-two buckets, in microseconds. The
+// first bucket is [0, 1), the last one holds everything from 2^30 us
+int const latency_buckets = 32;
+
+struct registry
+{
+	// set before any threads are started
+	bool enabled = false;
+	bool json = false;
+	clock::time_point start;
+
+	std::array<std::atomic<std::int64_t>, std::size_t(timer::num_timers)> time_ns{};
+	std::array<std::atomic<std::int64_t>, std::size_t(timer::num_timers)> calls{};
+	std::array<std::atomic<std::int64_t>, std::size_t(counter::num_counters)> counters{};
+	std::array<std::atomic<std::int64_t>, latency_buckets> read_latency{};
+};
+
+inline registry g_stats;
+
+inline int latency_bucket(std::int64_t const ns)
+{
+	std::int64_t us = ns / 1000;
+	int b = 0;
+	while (us > 0 && b < latency_buckets - 1) { us >>= 1; ++b; }
+	return b;
+}
+
+// the peak resident set size of the process, in bytes
+inline std::int64_t peak_rss()
+{
+#if defined _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return 0;
+	return std::int64_t(pmc.PeakWorkingSetSize);
+#else
+	struct rusage ru;
+	if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+#if defined __APPLE__
+	return std::int64_t(ru.ru_maxrss);
+#else
+	// kilobytes on linux and the BSDs
+	return std::int64_t(ru.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+inline void print()
+{
+	auto& s = g_stats;
+	if (!s.enabled) return;
+	double const total = std::chrono::duration<double>(clock::now() - s.start).count();
+	auto const ms = [](std::int64_t const ns) { return double(ns) / 1000000.0; };
+
+	char buf[200];
+	if (s.json) {
+		std::cerr << "{\n  \"total-ms\": " << total * 1000.0
+			<< ",\n  \"peak-rss\": " << peak_rss()
+			<< ",\n  \"timers\": {";
+		for (std::size_t i = 0; i < s.time_ns.size(); ++i) {
+			std::snprintf(buf, sizeof(buf), "%s\n    \"%s\": {\"ms\": %.3f, \"calls\": %lld}"
+				, i > 0 ? "," : "", timer_names[i], ms(s.time_ns[i])
+				, static_cast<long long>(s.calls[i].load()));
+			std::cerr << buf;
+		}
+		std::cerr << "\n  },\n  \"counters\": {";
+		for (std::size_t i = 0; i < s.counters.size(); ++i) {
+			std::cerr << (i > 0 ? ",\n    \"" : "\n    \"") << counter_names[i] << "\": "
+				<< s.counters[i].load();
+		}
+		// buckets are keyed by their upper bound, in microseconds
+		std::cerr << "\n  },\n  \"read-latency-us\": {";
+		bool first = true;
+		for (int i = 0; i < latency_buckets; ++i) {
+			std::int64_t const n = s.read_latency[std::size_t(i)];
+			if (n == 0) continue;
+			std::cerr << (first ? "\n    \"" : ",\n    \"") << (std::int64_t(1) << i) << "\": " << n;
+			first = false;
+		}
+		std::cerr << (first ? "}\n}\n" : "\n  }\n}\n");
+		return;
+	}
+
+	std::snprintf(buf, sizeof(buf), "total: %.3f ms\npeak RSS: %lld kB\n"
+		, total * 1000.0, static_cast<long long>(peak_rss() / 1024));
+	std::cerr << buf;
+	for (std::size_t i = 0; i < s.time_ns.size(); ++i) {
+		if (s.calls[i] == 0) continue;
+		std::snprintf(buf, sizeof(buf), "%-8s %12.3f ms %10lld calls\n", timer_names[i]
+			, ms(s.time_ns[i]), static_cast<long long>(s.calls[i].load()));
+		std::cerr << buf;
+	}
+	for (std::size_t i = 0; i < s.counters.size(); ++i) {
+		std::cerr << counter_names[i] << ": " << s.counters[i].load() << '\n';
+	}
+	bool first = true;
+	for (int i = 0; i < latency_buckets; ++i) {
+		std::int64_t const n = s.read_latency[std::size_t(i)];
+		if (n == 0) continue;
+		if (first) std::cerr << "read latency:\n";
+		first = false;
+		std::snprintf(buf, sizeof(buf), "  < %10lld us: %lld\n"
+			, static_cast<long long>(std::int64_t(1) << i), static_cast<long long>(n));
+		std::cerr << buf;
+	}
+}
+
+} // namespace detail
+
+inline bool enabled() { return detail::g_stats.enabled; }
+
+// turns on collecting stats, which are printed to stderr when the process
+// exits
+inline void enable(bool const json)
+{
+	auto& s = detail::g_stats;
+	if (s.enabled) return;
+	s.enabled = true;
+	s.json = json;
+	s.start = detail::clock::now();
+	std::atexit(&detail::print);
+}
+
+// handles the --stats and --stats=json options. Returns true if "arg" was one
+// of them
+inline bool parse_option(std::string_view const arg)
+{
+	using namespace std::string_view_literals;
+	if (arg == "--stats"sv) enable(false);
+	else if (arg == "--stats=json"sv) enable(true);
+	else return false;
+	return true;
+}
+
+inline void add(counter const c, std::int64_t const n)
+{
+	if (!enabled()) return;
+	detail::g_stats.counters[std::size_t(c)].fetch_add(n, std::memory_order_relaxed);
+}
+
+// adds the time from construction to destruction to a timer
+struct scoped_timer
+{
+	explicit scoped_timer(timer const t)
+		: m_timer(t)
+		, m_start(enabled() ? detail::clock::now() : detail::clock::time_point())
+	{}
+
+	scoped_timer(scoped_timer const&) = delete;
+	scoped_timer& operator=(scoped_timer const&) = delete;
+
+	~scoped_timer() { stop(); }
+
+	// records the time so far, instead of at destruction
+	void stop()
+	{
+		if (!enabled() || m_stopped) return;
+		m_stopped = true;
+		std::int64_t const ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			detail::clock::now() - m_start).count();
+		auto& s = detail::g_stats;
+		s.time_ns[std::size_t(m_timer)].fetch_add(ns, std::memory_order_relaxed);
+		s.calls[std::size_t(m_timer)].fetch_add(1, std::memory_order_relaxed);
+		if (m_timer == timer::read)
+			s.read_latency[std::size_t(detail::latency_bucket(ns))].fetch_add(1, std::memory_order_relaxed);
+	}
+
+private:
+	timer const m_timer;
+	detail::clock::time_point const m_start;
+	bool m_stopped = false;
+};
+
+} // namespace stats
@@ -0,0 +1,33 @@
+/*
+
+Copyright (c) 2026, Arvid Norberg
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+// replaces the global operator new and delete, to count allocations for
+// --stats. This must be linked into a program at most once, so it's a
+// translation unit of its own, rather than part of stats.hpp
+
+#include "stats.hpp"
+
+#include <cstdlib>
+#include <new>
+
+void* operator new(std::size_t const size)
+{
+	if (stats::enabled()) {
+		auto& s = stats::detail::g_stats;
+		s.counters[std::size_t(stats::counter::allocations)].fetch_add(1, std::memory_order_relaxed);
+		s.counters[std::size_t(stats::counter::allocated_bytes)].fetch_add(std::int64_t(size)
+			, std::memory_order_relaxed);
+	}
+	void* const ret = std::malloc(size == 0 ? 1 : size);
+	if (ret == nullptr) throw std::bad_alloc();
+	return ret;
+}
+
+void operator delete(void* const ptr) noexcept { std::free(ptr); }
+void operator delete(void* const ptr, std::size_t) noexcept { std::free(ptr); }
@@ -5,6 +5,9 @@ import unittest
 import subprocess
 import os
 import itertools
+import hashlib
+import json
+import shutil
 
 def run(args):
 	out = subprocess.check_output(args).decode('utf-8')
@@ -12,21 +15,44 @@ def run(args):
 	print(out)
 	return out.strip().split('\n')
 
+def create_test_files():
+	# create some test files
+	try: os.mkdir('test-files')
+	except: pass
+	global test_files_
+	global size_
+
+	test_files_ = ['test-files/file-number-1', 'test-files/file-number-2', 'test-files/file-number-3']
+	size_ = [16000, 32000, 300]
+
+	for i in range(len(test_files_)):
+		run(['dd', 'bs=512', f'count={size_[i]}', 'if=/dev/random', f'of={test_files_[i]}'])
+
+def bencode(v):
+	if isinstance(v, int): return b'i%de' % v
+	if isinstance(v, str): v = v.encode('utf-8')
+	if isinstance(v, bytes): return b'%d:' % len(v) + v
+	if isinstance(v, list): return b'l' + b''.join(bencode(i) for i in v) + b'e'
+	return b'd' + b''.join(bencode(k) + bencode(v[k]) for k in sorted(v)) + b'e'
+
+# torrent-new only creates torrents with piece-aligned files. This creates a
+# classic v1 torrent, without pad files. "extra" are additional keys of the
+# top-level dictionary
+def create_v1_torrent(out, directory, files, piece_size, extra={}):
+	data = b''
+	for f in files:
+		with open(os.path.join(directory, f), 'rb') as fh: data += fh.read()
+	pieces = b''.join(hashlib.sha1(data[i:i + piece_size]).digest() \
+		for i in range(0, len(data), piece_size))
+	info = {'name': os.path.split(directory)[1], 'piece length': piece_size, 'pieces': pieces,
+		'files': [{'length': os.path.getsize(os.path.join(directory, f)), 'path': [f]} for f in files]}
+	with open(out, 'wb') as fh: fh.write(bencode({'info': info, **extra}))
+
 class TestNew(unittest.TestCase):
 
 	@classmethod
 	def setUpClass(cls):
-		# create some test files
-		try: os.mkdir('test-files')
-		except: pass
-		global test_files_
-		global size_
-
-		test_files_ = ['test-files/file-number-1', 'test-files/file-number-2', 'test-files/file-number-3']
-		size_ = [16000, 32000, 300]
-
-		for i in range(len(test_files_)):
-			run(['dd', 'bs=512', f'count={size_[i]}', 'if=/dev/random', f'of={test_files_[i]}'])
+		create_test_files()
 
 	def test_single_file(self):
 		for f in test_files_:
@@ -181,6 +207,125 @@ class TestNew(unittest.TestCase):
 		self.assertIn('v1:', out[0])
 		self.assertIn('v2:', out[0])
 
+	def test_base(self):
+		run(['./torrent-new', '-m', '-o', 'test1.torrent', 'test-files'])
+
+		# pretend one file was modified
+		st = os.stat(test_files_[2])
+		os.utime(test_files_[2], (st.st_atime, st.st_mtime - 100))
+
+		out = run(['./torrent-new', '-m', '--base', 'test1.torrent', '-o', 'test.torrent', 'test-files'])
+		self.assertIn('changed: test-files/file-number-3', out)
+		self.assertIn('2 unchanged, 1 changed, 0 new, 0 removed files', out)
+
+		# the result must be identical to hashing everything
+		run(['./torrent-new', '-m', '-o', 'test2.torrent', 'test-files'])
+		out = run(['./torrent-print', '--info-hash', 'test.torrent'])
+		expected = run(['./torrent-print', '--info-hash', 'test2.torrent'])
+		self.assertEqual(out, expected)
+
+	def test_base_last_file(self):
+		# the last piece of a file is only padded if another file follows it.
+		# Adding or removing the last file changes that for the file before it
+		shutil.rmtree('test-base', ignore_errors=True)
+		os.mkdir('test-base')
+		shutil.copy2(test_files_[2], 'test-base/a')
+		run(['./torrent-new', '-m', '-s', '16', '-o', 'test1.torrent', 'test-base'])
+
+		shutil.copy2(test_files_[2], 'test-base/b')
+		out = run(['./torrent-new', '-m', '-s', '16', '--base', 'test1.torrent', '-o', 'test.torrent', 'test-base'])
+		self.assertIn('1 unchanged, 0 changed, 1 new, 0 removed files', out)
+		run(['./torrent-new', '-m', '-s', '16', '-o', 'test2.torrent', 'test-base'])
+		self.assertEqual(run(['./torrent-print', '--info-hash', 'test.torrent']),
+			run(['./torrent-print', '--info-hash', 'test2.torrent']))
+
+		os.remove('test-base/b')
+		run(['./torrent-new', '-m', '-s', '16', '--base', 'test2.torrent', '-o', 'test.torrent', 'test-base'])
+		self.assertEqual(run(['./torrent-print', '--info-hash', 'test.torrent']),
+			run(['./torrent-print', '--info-hash', 'test1.torrent']))
+
+	def test_hybrid_hashes(self):
+		# the v1 hashes are computed in the same pass as the v2 hashes. Check
+		# them against the ones torrent-verify computes from the pieces
+		run(['./torrent-new', '--hdd-depth', '2', '--ssd-depth', '1', '-o', 'test.torrent', 'test-files'])
+		p = subprocess.run(['./torrent-verify', '--v1', 'test.torrent'], stdout=subprocess.PIPE)
+		print(p.stdout.decode('utf-8'))
+		self.assertEqual(p.returncode, 0)
+		self.assertEqual(json.loads(p.stdout)['bad-v1-pieces'], [])
+
+		# reading the files in a different order must not change the torrent
+		run(['./torrent-new', '--hdd', '-o', 'test2.torrent', 'test-files'])
+		out = run(['./torrent-print', '--info-hash', 'test.torrent'])
+		expected = run(['./torrent-print', '--info-hash', 'test2.torrent'])
+		self.assertEqual(out, expected)
+
+	def test_stats(self):
+		p = subprocess.run(['./torrent-new', '-2', '--stats=json', '-o', 'test.torrent', 'test-files']
+			, stdout=subprocess.PIPE, stderr=subprocess.PIPE, check=True)
+		# torrent-new prints the files it adds to stderr too, before the stats
+		stats = json.loads(p.stderr[p.stderr.index(b'{'):])
+		print(stats)
+		self.assertGreater(stats['timers']['sha256']['calls'], 0)
+		self.assertGreater(stats['counters']['bytes-read'], 0)
+		self.assertEqual(stats['counters']['bytes-written'], os.path.getsize('test.torrent'))
+		self.assertGreater(stats['peak-rss'], 0)
+
+	def test_stdin(self):
+		f = test_files_[1]
+		name = os.path.split(f)[1]
+		run(['./torrent-new', '-o', 'test.torrent', f])
+		expected = run(['./torrent-print', '--info-hash', 'test.torrent'])
+
+		# the same file, streamed through stdin, with its size known up front
+		with open(f, 'rb') as fh:
+			subprocess.run(['./torrent-new', '--stdin', '--name', name, '--size', str(os.path.getsize(f)),
+				'--tee', 'test-tee', '-o', 'test2.torrent'], stdin=fh, check=True)
+		self.assertEqual(run(['./torrent-print', '--info-hash', 'test2.torrent']), expected)
+		with open(f, 'rb') as a, open('test-tee', 'rb') as b:
+			self.assertEqual(a.read(), b.read())
+
+		# and without, which requires the piece size, for the v1 hashes
+		piece_size = run(['./torrent-print', '--piece-size', 'test.torrent'])[0].split(' ')[-1]
+		with open(f, 'rb') as fh:
+			subprocess.run(['./torrent-new', '--stdin', '--name', name, '-s', str(int(piece_size) // 1024),
+				'-o', 'test2.torrent'], stdin=fh, check=True)
+		self.assertEqual(run(['./torrent-print', '--info-hash', 'test2.torrent']), expected)
+
+		# a size that doesn't match the content is an error
+		with open(f, 'rb') as fh:
+			p = subprocess.run(['./torrent-new', '--stdin', '--name', name, '--size', '1000',
+				'-o', 'test2.torrent'], stdin=fh)
+		self.assertNotEqual(p.returncode, 0)
+
+	def test_copy_to(self):
+		shutil.rmtree('test-copy', ignore_errors=True)
+		run(['./torrent-new', '--mtime', '--copy-to', 'test-copy', '-o', 'test.torrent', 'test-files'])
+		for f in test_files_:
+			with open(f, 'rb') as a, open(os.path.join('test-copy', f), 'rb') as b:
+				self.assertEqual(a.read(), b.read())
+
+		# the torrent must be the same as one created from the copy
+		run(['./torrent-new', '--mtime', '-o', 'test2.torrent', 'test-copy/test-files'])
+		out = run(['./torrent-print', '--info-hash', 'test.torrent'])
+		expected = run(['./torrent-print', '--info-hash', 'test2.torrent'])
+		self.assertEqual(out, expected)
+
+	def test_hard_links(self):
+		shutil.rmtree('test-links', ignore_errors=True)
+		os.mkdir('test-links')
+		shutil.copy(test_files_[0], 'test-links/a')
+		os.link('test-links/a', 'test-links/b')
+		shutil.copy(test_files_[0], 'test-links/c')
+		p = subprocess.run(['./torrent-new', '--stats=json', '-o', 'test.torrent', 'test-links']
+			, stdout=subprocess.PIPE, stderr=subprocess.PIPE, check=True)
+		stats = json.loads(p.stderr[p.stderr.index(b'{'):])
+		# the hard link is only read once, the copy is read too
+		self.assertEqual(stats['counters']['bytes-read'], 2 * os.path.getsize(test_files_[0]))
+
+		p = subprocess.run(['./torrent-verify', '--v1', 'test.torrent'], stdout=subprocess.PIPE)
+		print(p.stdout.decode('utf-8'))
+		self.assertEqual(p.returncode, 0)
+
 	def test_dht_nodes(self):
 		run(['./torrent-new', '--dht-node', 'router1.com', '6881', '-o', 'test.torrent', 'test-files'])
 		out = run(['./torrent-print', '--dht-nodes', 'test.torrent'])
@@ -194,6 +339,378 @@ class TestNew(unittest.TestCase):
 # test_symlinks
 
 
+class TestAdd(unittest.TestCase):
+
+	@classmethod
+	def setUpClass(cls):
+		create_test_files()
+
+	def test_add_files(self):
+		run(['./torrent-new', '-2', '-o', 'test1.torrent', test_files_[0]])
+		run(['./torrent-add', 'test1.torrent', '-o', 'test.torrent', test_files_[1], test_files_[2]])
+		out = run(['./torrent-print', '--files', '--flat', 'test.torrent'])
+
+		# strip out "files:"
+		out = out[1:]
+		names = [os.path.split(l.strip().split(' ')[-1])[1] for l in out]
+		self.assertEqual(names, ['file-number-1', 'file-number-2', 'file-number-3'])
+
+	def test_add_directory(self):
+		run(['./torrent-new', '-2', '-o', 'test1.torrent', test_files_[0]])
+		run(['./torrent-add', 'test1.torrent', '-o', 'test.torrent', 'test-files'])
+		out = run(['./torrent-print', '--files', '--flat', 'test.torrent'])
+
+		# strip out "files:"
+		out = out[1:]
+		names = [l.strip().split(' ')[-1] for l in out]
+		self.assertEqual(names, ['file-number-1/file-number-1'] \
+			+ ['file-number-1/' + f for f in test_files_])
+
+		# adding the same files again is an error
+		with self.assertRaises(Exception):
+			run(['./torrent-add', 'test.torrent', '-o', 'test2.torrent', 'test-files'])
+
+class TestMerge(unittest.TestCase):
+
+	@classmethod
+	def setUpClass(cls):
+		create_test_files()
+
+	def test_hybrid(self):
+		run(['./torrent-new', '-o', 'test1.torrent', test_files_[0]])
+		run(['./torrent-new', '-o', 'test2.torrent', test_files_[2]])
+
+		# file-number-3 is hashed with a smaller piece size than the merged
+		# torrent, so its v1 hashes must be computed from the data
+		with self.assertRaises(Exception):
+			run(['./torrent-merge', '--hybrid', '-o', 'test.torrent', 'test1.torrent', 'test2.torrent'])
+
+		run(['./torrent-merge', '--hybrid', '--data-dir', 'test-files', '-o', 'test.torrent', 'test1.torrent', 'test2.torrent'])
+		out = run(['./torrent-print', '--info-hash', 'test.torrent'])
+		self.assertIn('v1:', out[0])
+		self.assertIn('v2:', out[0])
+
+		out = run(['./torrent-print', '--files', '--flat', 'test.torrent'])
+		self.assertEqual(len(out), 3)
+
+	def test_v2_only(self):
+		run(['./torrent-new', '-2', '-o', 'test1.torrent', test_files_[0]])
+		run(['./torrent-new', '-2', '-o', 'test2.torrent', test_files_[1]])
+		run(['./torrent-merge', '-o', 'test.torrent', 'test1.torrent', 'test2.torrent'])
+		out = run(['./torrent-print', '--info-hash', 'test.torrent'])
+		self.assertNotIn('v1:', out[0])
+		self.assertIn('v2:', out[0])
+
+class TestModify(unittest.TestCase):
+
+	@classmethod
+	def setUpClass(cls):
+		create_test_files()
+
+	def test_metadata_only(self):
+		run(['./torrent-new', '--tracker', 'https://tracker1.test/announce', '-o', 'test1.torrent', 'test-files'])
+		run(['./torrent-modify', '--comment', 'foobar', '--drop-trackers', \
+			'--tracker', 'https://tracker2.test/announce', '-o', 'test.torrent', 'test1.torrent'])
+
+		# changing fields outside of the info dictionary preserves the
+		# info-hash
+		before = run(['./torrent-print', '--info-hash', 'test1.torrent'])
+		after = run(['./torrent-print', '--info-hash', 'test.torrent'])
+		self.assertEqual(before, after)
+
+		out = run(['./torrent-print', '--comment', 'test.torrent'])
+		self.assertEqual(out[0], 'comment: foobar')
+
+		out = run(['./torrent-print', '--trackers', 'test.torrent'])
+		self.assertEqual(out[1:], [' 0: https://tracker2.test/announce'])
+
+	def test_comment_utf8(self):
+		create_v1_torrent('test1.torrent', 'test-files', ['file-number-1'], 32768,
+			{'comment': 'old', 'comment.utf-8': 'old'})
+		run(['./torrent-modify', '--comment', 'foobar', '-o', 'test.torrent', 'test1.torrent'])
+		self.assertEqual(run(['./torrent-print', '--info-hash', 'test1.torrent']),
+			run(['./torrent-print', '--info-hash', 'test.torrent']))
+		out = run(['./torrent-print', '--comment', 'test.torrent'])
+		self.assertEqual(out[0], 'comment: foobar')
+
+	def test_keep_mtime_symlinks(self):
+		shutil.rmtree('test-links', ignore_errors=True)
+		os.mkdir('test-links')
+		shutil.copy(test_files_[2], 'test-links/x')
+		shutil.copy(test_files_[2], 'test-links/y')
+		os.symlink('x', 'test-links/l')
+		run(['./torrent-new', '--mtime', '-l', '-o', 'test1.torrent', 'test-links'])
+
+		def files(torrent):
+			out = run(['./torrent-print', '--file-mtime', '--files', '--flat', torrent])
+			return [l for l in out[1:] if 'test-links/y' not in l]
+
+		# dropping a file re-creates the info dictionary, the mtime and
+		# symlinks of the other files are kept
+		run(['./torrent-modify', '--drop-file', 'y', '--data-dir', '.', '-o', 'test.torrent', 'test1.torrent'])
+		before = files('test1.torrent')
+		self.assertEqual(files('test.torrent'), before)
+		self.assertTrue(any(' -> ' in l for l in before))
+
+		run(['./torrent-modify', '--drop-file', 'y', '--drop-mtime', '--data-dir', '.', \
+			'-o', 'test.torrent', 'test1.torrent'])
+		self.assertNotEqual(files('test.torrent'), before)
+
+	def test_bulk(self):
+		try: os.mkdir('test-out')
+		except: pass
+		run(['./torrent-new', '-o', 'test1.torrent', test_files_[0]])
+		run(['./torrent-new', '-o', 'test2.torrent', test_files_[1]])
+		run(['./torrent-modify', '--comment', 'foobar', '--out-dir', 'test-out', 'test1.torrent', 'test2.torrent'])
+
+		for f in ['test1.torrent', 'test2.torrent']:
+			out = run(['./torrent-print', '--comment', os.path.join('test-out', f)])
+			self.assertEqual(out[0], 'comment: foobar')
+
+		run(['./torrent-modify', '--comment', 'baz', '--in-place', 'test1.torrent'])
+		out = run(['./torrent-print', '--comment', 'test1.torrent'])
+		self.assertEqual(out[0], 'comment: baz')
+
+		# two inputs must never be written to the same file
+		shutil.rmtree('test-out', ignore_errors=True)
+		shutil.rmtree('test-in', ignore_errors=True)
+		os.mkdir('test-in')
+		shutil.copy('test2.torrent', os.path.join('test-in', 'test1.torrent'))
+		with self.assertRaises(subprocess.CalledProcessError):
+			run(['./torrent-modify', '--comment', 'foobar', '--out-dir', 'test-out', \
+				'test1.torrent', os.path.join('test-in', 'test1.torrent')])
+		self.assertFalse(os.path.exists('test-out'))
+		with self.assertRaises(subprocess.CalledProcessError):
+			run(['./torrent-modify', '--comment', 'foobar', '--in-place', \
+				'test1.torrent', './test1.torrent'])
+		out = run(['./torrent-print', '--comment', 'test1.torrent'])
+		self.assertEqual(out[0], 'comment: baz')
+
+	def test_drop_file_unaligned(self):
+		create_v1_torrent('test1.torrent', 'test-files', ['file-number-3', 'file-number-1', 'file-number-2'], 32768)
+		create_v1_torrent('test2.torrent', 'test-files', ['file-number-3', 'file-number-2'], 32768)
+
+		# the boundary pieces need to be hashed again, which requires the data
+		with self.assertRaises(subprocess.CalledProcessError):
+			run(['./torrent-modify', '--drop-file', 'file-number-1', '-o', 'test.torrent', 'test1.torrent'])
+
+		run(['./torrent-modify', '--drop-file', 'file-number-1', '--data-dir', '.', '-o', 'test.torrent', 'test1.torrent'])
+		out = run(['./torrent-print', '--info-hash', 'test.torrent'])
+		expected = run(['./torrent-print', '--info-hash', 'test2.torrent'])
+		self.assertEqual(out, expected)
+
+		# renaming doesn't move any data, so it doesn't need --data-dir
+		run(['./torrent-modify', '--rename-file', 'file-number-1', 'foobar', '-o', 'test.torrent', 'test1.torrent'])
+
+	def test_drop_rename_patterns(self):
+		run(['./torrent-new', '-o', 'test1.torrent', 'test-files'])
+		run(['./torrent-modify', '--drop', 'file-number-[!3]', '--drop-larger', '100m', \
+			'--rename-regex', 'number-([0-9])$', 'no-$1', '-o', 'test.torrent', 'test1.torrent'])
+		out = run(['./torrent-print', '--files', '--flat', 'test.torrent'])
+		names = [l.strip().split(' ')[-1] for l in out[1:]]
+		self.assertEqual(names, ['test-files/file-no-3'])
+
+		run(['./torrent-modify', '--drop-smaller', '1m', '--rename', 'test-files/**/*-2', 'foobar', \
+			'-o', 'test.torrent', 'test1.torrent'])
+		out = run(['./torrent-print', '--files', '--flat', 'test.torrent'])
+		names = [l.strip().split(' ')[-1] for l in out[1:]]
+		self.assertEqual(names, ['test-files/file-number-1', 'test-files/foobar'])
+
+		# chained "**/" may all match no directories, but "**/" can't match
+		# part of a name
+		run(['./torrent-modify', '--drop', 'test-files/**/**/file-number-1', \
+			'--drop', 'test-files/**/ile-number-2', '-o', 'test.torrent', 'test1.torrent'])
+		out = run(['./torrent-print', '--files', '--flat', 'test.torrent'])
+		names = [l.strip().split(' ')[-1] for l in out[1:]]
+		self.assertEqual(names, ['test-files/file-number-2', 'test-files/file-number-3'])
+
+		# only the first match is replaced
+		run(['./torrent-modify', '--rename-regex', 'e(?=[^/]*$)', 'E', '-o', 'test.torrent', 'test1.torrent'])
+		out = run(['./torrent-print', '--files', '--flat', 'test.torrent'])
+		names = [l.strip().split(' ')[-1] for l in out[1:]]
+		self.assertEqual(names, ['test-files/filE-number-1', 'test-files/filE-number-2', 'test-files/filE-number-3'])
+
+class TestVerify(unittest.TestCase):
+
+	@classmethod
+	def setUpClass(cls):
+		create_test_files()
+
+	def verify(self, args):
+		p = subprocess.run(['./torrent-verify'] + args, stdout=subprocess.PIPE)
+		print(p.stdout.decode('utf-8'))
+		return p.returncode, json.loads(p.stdout)
+
+	def test_verify(self):
+		run(['./torrent-new', '-o', 'test.torrent', 'test-files'])
+		ret, out = self.verify(['test.torrent'])
+		self.assertEqual(ret, 0)
+		self.assertTrue(out['ok'])
+		self.assertEqual(out['files'], 3)
+
+		shutil.rmtree('test-verify', ignore_errors=True)
+		shutil.copytree('test-files', 'test-verify/test-files')
+		with open('test-verify/test-files/file-number-2', 'r+b') as f:
+			f.seek(100000)
+			f.write(b'x' * 10)
+		os.remove('test-verify/test-files/file-number-3')
+
+		ret, out = self.verify(['--v1', '-d', 'test-verify', 'test.torrent'])
+		self.assertEqual(ret, 2)
+		self.assertFalse(out['ok'])
+		bad = {f['path']: f for f in out['bad-files']}
+		self.assertEqual(bad['test-files/file-number-3']['error'], 'missing')
+		self.assertEqual(bad['test-files/file-number-2']['error'], 'hash mismatch')
+		self.assertEqual(len(bad['test-files/file-number-2']['bad-pieces']), 1)
+		self.assertNotIn('test-files/file-number-1', bad)
+		self.assertNotEqual(out['bad-v1-pieces'], [])
+
+	def test_sidecar(self):
+		run(['./torrent-new', '--sidecar', '-o', 'test.torrent', 'test-files'])
+		ret, out = self.verify(['--use-sidecars', 'test.torrent'])
+		self.assertEqual(ret, 0)
+		self.assertTrue(out['ok'])
+
+		layers = run(['./torrent-print', '--piece-layers', 'test.torrent'])
+		self.assertEqual(run(['./torrent-print', '--use-sidecars', '--piece-layers', 'test.torrent']), layers)
+
+		# merging with the piece layers from the sidecars gives the same torrent
+		run(['./torrent-new', '-o', 'test1.torrent', '--sidecar', test_files_[0]])
+		run(['./torrent-merge', '-o', 'test2.torrent', 'test1.torrent', 'test.torrent'])
+		run(['./torrent-merge', '--use-sidecars', '--sidecar', '-o', 'test3.torrent', 'test1.torrent', 'test.torrent'])
+		self.assertEqual(run(['./torrent-print', '--info-hash', 'test2.torrent']),
+			run(['./torrent-print', '--info-hash', 'test3.torrent']))
+		self.assertTrue(os.path.exists('test3.torrent.sidecar'))
+
+		# a sidecar of another torrent is rejected
+		shutil.copy('test1.torrent.sidecar', 'test.torrent.sidecar')
+		p = subprocess.run(['./torrent-verify', '--use-sidecars', 'test.torrent'], stdout=subprocess.PIPE)
+		self.assertEqual(p.returncode, 1)
+
+		# as is one whose file table doesn't match the torrent, even though its
+		# header does
+		run(['./torrent-new', '--sidecar', '-o', 'test.torrent', 'test-files'])
+		with open('test.torrent.sidecar', 'r+b') as f:
+			f.seek(64)
+			root = f.read(1)
+			f.seek(64)
+			f.write(bytes([root[0] ^ 0xff]))
+		p = subprocess.run(['./torrent-verify', '--use-sidecars', 'test.torrent'], stdout=subprocess.PIPE)
+		self.assertEqual(p.returncode, 1)
+
+		# and so is one with a piece layer that doesn't match its root
+		run(['./torrent-new', '--sidecar', '-o', 'test.torrent', 'test-files'])
+		cmds = [['./torrent-verify', '--use-sidecars'],
+			['./torrent-merge', '--use-sidecars', '-o', 'test2.torrent', 'test1.torrent'],
+			['./torrent-split', '--use-sidecars', '--depth', '1', '-o', 'test-split-out']]
+		for cmd in cmds:
+			run(cmd + ['test.torrent'])
+		with open('test.torrent.sidecar', 'r+b') as f:
+			f.seek(-1, os.SEEK_END)
+			last = f.read(1)
+			f.seek(-1, os.SEEK_END)
+			f.write(bytes([last[0] ^ 0xff]))
+		for cmd in cmds:
+			p = subprocess.run(cmd + ['test.torrent'], stdout=subprocess.PIPE)
+			self.assertEqual(p.returncode, 1)
+
+class TestDedup(unittest.TestCase):
+
+	@classmethod
+	def setUpClass(cls):
+		create_test_files()
+
+	def test_dedup(self):
+		run(['./torrent-new', '-o', 'test1.torrent', test_files_[0]])
+		run(['./torrent-new', '-o', 'test2.torrent', 'test-files'])
+		out = run(['./torrent-dedup', '--print-duplicates', '--memory', '1', 'test1.torrent', 'test2.torrent'])
+		self.assertIn('   test1.torrent: file-number-1', out)
+		self.assertIn('   test2.torrent: test-files/file-number-1', out)
+		self.assertIn('duplicate files: 2 in 1 groups, 8.2 MB (8192000 bytes) redundant', out)
+
+	def test_dedup_same_hash(self):
+		# more copies of the same file than fit in the memory limit. Splitting
+		# them by hash doesn't help
+		try: os.mkdir('test-same')
+		except: pass
+		for i in range(10000):
+			with open(os.path.join('test-same', 'file-%05d' % i), 'wb') as f: f.write(b'x')
+		run(['./torrent-new', '-o', 'test1.torrent', 'test-same'])
+		out = run(['./torrent-dedup', '--print-duplicates', '--memory', '1', 'test1.torrent'])
+		self.assertEqual(len([l for l in out if l.endswith('10000 copies:')]), 1)
+		self.assertIn('   test1.torrent: test-same/file-09999', out)
+		self.assertIn('duplicate files: 10000 in 1 groups', out[-1])
+		self.assertIn('(9999 bytes) redundant', out[-1])
+
+class TestSplit(unittest.TestCase):
+
+	@classmethod
+	def setUpClass(cls):
+		create_test_files()
+		shutil.rmtree('test-split', ignore_errors=True)
+		os.makedirs('test-split/a/b')
+		os.makedirs('test-split/c')
+		shutil.copy(test_files_[0], 'test-split/a/b/x')
+		shutil.copy(test_files_[1], 'test-split/a/y')
+		shutil.copy(test_files_[2], 'test-split/c/z')
+		shutil.copy(test_files_[2], 'test-split/w')
+
+	def files(self, torrent):
+		out = run(['./torrent-print', '--files', '--flat', torrent])
+		return sorted(l.strip().split(' ')[-1] for l in out[1:])
+
+	def test_depth(self):
+		shutil.rmtree('test-split-out', ignore_errors=True)
+		run(['./torrent-new', '-2', '-o', 'test.torrent', 'test-split'])
+		run(['./torrent-split', '--depth', '1', '-o', 'test-split-out', 'test.torrent'])
+		self.assertEqual(sorted(os.listdir('test-split-out')), ['a.torrent', 'c.torrent', 'test-split.torrent'])
+		self.assertEqual(self.files('test-split-out/a.torrent'), ['a/b/x', 'a/y'])
+		self.assertEqual(self.files('test-split-out/test-split.torrent'), ['test-split/w'])
+
+		# the v2 hashes are carried over, so the files verify against them
+		for t, d in [('a', 'test-split'), ('c', 'test-split'), ('test-split', '.')]:
+			p = subprocess.run(['./torrent-verify', '-d', d, f'test-split-out/{t}.torrent'], stdout=subprocess.PIPE)
+			self.assertEqual(p.returncode, 0)
+
+	def test_max_files(self):
+		shutil.rmtree('test-split-out', ignore_errors=True)
+		run(['./torrent-new', '-o', 'test.torrent', 'test-split'])
+
+		# the last piece of each hybrid torrent needs to be hashed again
+		with self.assertRaises(subprocess.CalledProcessError):
+			run(['./torrent-split', '--max-files', '3', '-o', 'test-split-out', 'test.torrent'])
+
+		run(['./torrent-split', '--max-files', '3', '--data-dir', '.', '-o', 'test-split-out', 'test.torrent'])
+		self.assertEqual(sorted(os.listdir('test-split-out')), ['test-split-1.torrent', 'test-split-2.torrent'])
+		for t in os.listdir('test-split-out'):
+			p = subprocess.run(['./torrent-verify', '--v1', f'test-split-out/{t}'], stdout=subprocess.PIPE)
+			self.assertEqual(p.returncode, 0)
+
+	def test_symlinks(self):
+		shutil.rmtree('test-split-links', ignore_errors=True)
+		shutil.rmtree('test-split-out', ignore_errors=True)
+		os.makedirs('test-split-links/a')
+		os.makedirs('test-split-links/c')
+		shutil.copy(test_files_[2], 'test-split-links/a/x')
+		shutil.copy(test_files_[2], 'test-split-links/c/y')
+		os.symlink('x', 'test-split-links/a/inside')
+		os.symlink('../c', 'test-split-links/a/dir-inside')
+		os.symlink('../c/y', 'test-split-links/a/across')
+		os.symlink('c/y', 'test-split-links/root')
+		run(['./torrent-new', '-2', '-l', '-o', 'test.torrent', 'test-split-links'])
+		self.assertIn(' -> test-split-links/c/y', '\n'.join(run(['./torrent-print', '--files', '--flat', 'test.torrent'])))
+
+		out = run(['./torrent-split', '--depth', '1', '-o', 'test-split-out', 'test.torrent'])
+		ignored = sorted(l for l in out if l.startswith('ignoring '))
+		# links into directories that were split off into other torrents would
+		# be dangling
+		self.assertEqual(ignored, [
+			'ignoring test-split-links/a/across (symlink out of the torrent)',
+			'ignoring test-split-links/a/dir-inside (symlink out of the torrent)',
+			'ignoring test-split-links/root (symlink out of the torrent)'])
+		a = '\n'.join(run(['./torrent-print', '--files', '--flat', 'test-split-out/a.torrent']))
+		self.assertIn('a/inside -> a/x', a)
+
 class TestPrint(unittest.TestCase):
 
 	def test_tree(self):
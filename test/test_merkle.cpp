@@ -0,0 +1,145 @@
+/*
+
+Copyright (c) 2026, Arvid Norberg
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#include <cstdio> // for remove
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "libtorrent/create_torrent.hpp"
+#include "libtorrent/torrent_info.hpp"
+#include "libtorrent/bencode.hpp"
+
+#include "merkle.hpp"
+
+namespace {
+
+int failures = 0;
+
+#define TEST_CHECK(x) do { if (!(x)) { \
+	std::cerr << __FILE__ << ":" << __LINE__ << ": FAILED: " #x "\n"; \
+	++failures; } } while (false)
+
+std::mt19937 rng(0x1337);
+
+std::vector<lt::sha256_hash> random_hashes(std::size_t const n)
+{
+	std::vector<lt::sha256_hash> ret(n);
+	for (auto& h : ret)
+		for (int i = 0; i < int(h.size()); ++i) h[i] = static_cast<std::uint8_t>(rng());
+	return ret;
+}
+
+// every leaf can be verified against the root with its proof, but not with a
+// tampered proof or leaf
+void test_proof()
+{
+	for (std::size_t const num_leafs : {1, 2, 4, 8, 64}) {
+		for (std::size_t const n : {std::size_t(1), num_leafs / 2 + 1, num_leafs}) {
+			for (int const pad_level : {0, 3}) {
+				auto const leafs = random_hashes(n);
+				merkle_tree const t(leafs, num_leafs, pad_level);
+				TEST_CHECK(t.root() == merkle_root(leafs, num_leafs, pad_level));
+				TEST_CHECK(std::size_t(t.leafs().size()) == num_leafs);
+
+				for (std::size_t i = 0; i < num_leafs; ++i) {
+					auto const proof = t.proof(i);
+					TEST_CHECK(int(proof.size()) == merkle_depth(num_leafs));
+					TEST_CHECK(merkle_verify_proof(t.leafs()[i], i, proof, t.root()));
+
+					lt::sha256_hash leaf = t.leafs()[i];
+					leaf[0] ^= 1;
+					TEST_CHECK(!merkle_verify_proof(leaf, i, proof, t.root()));
+
+					if (proof.empty()) continue;
+					auto tampered = proof;
+					tampered[rng() % tampered.size()][31] ^= 0x80;
+					TEST_CHECK(!merkle_verify_proof(t.leafs()[i], i, tampered, t.root()));
+				}
+			}
+		}
+	}
+}
+
+// libtorrent computes the piece layers and the root of a file from its blocks.
+// Starting from the layer of one piece size, merkle_raise_layer() must produce
+// the layers of the larger ones, and merkle_root() (from any of them, with
+// their pad level) the file's root
+void test_libtorrent_layers()
+{
+	// 42.7 blocks, so no level is a power of 2
+	std::string const filename = "test_merkle.dat";
+	{
+		std::vector<char> data(700000);
+		for (auto& c : data) c = char(rng());
+		std::ofstream out(filename, std::ios_base::binary);
+		out.write(data.data(), std::streamsize(data.size()));
+	}
+
+	lt::sha256_hash root;
+	std::vector<std::vector<lt::sha256_hash>> layers;
+	std::vector<int> const piece_sizes = {merkle_block_size, merkle_block_size * 4
+		, merkle_block_size * 16};
+	for (int const piece_size : piece_sizes) {
+		lt::file_storage fs;
+		lt::add_files(fs, filename);
+		lt::create_torrent t(fs, piece_size, lt::create_torrent::v2_only);
+		lt::set_piece_hashes(t, ".");
+		std::vector<char> buf;
+		lt::bencode(std::back_inserter(buf), t.generate());
+		lt::torrent_info const ti(buf, lt::from_span);
+
+		lt::file_index_t const f{0};
+		root = ti.files().root(f);
+		auto const layer = ti.piece_layer(f);
+		auto& l = layers.emplace_back();
+		for (int i = 0; i < int(layer.size()); i += int(lt::sha256_hash::size()))
+			l.emplace_back(layer.data() + i);
+	}
+	std::remove(filename.c_str());
+
+	for (std::size_t i = 0; i < layers.size(); ++i) {
+		int const pad_level = merkle_depth(std::size_t(piece_sizes[i] / merkle_block_size));
+		std::size_t const num_leafs = merkle_num_leafs(layers[i].size());
+		TEST_CHECK(merkle_root(layers[i], num_leafs, pad_level) == root);
+		TEST_CHECK(merkle_tree(layers[i], num_leafs, pad_level).root() == root);
+
+		merkle_builder b(pad_level);
+		for (auto const& h : layers[i]) b.add(h);
+		TEST_CHECK(b.root(num_leafs) == root);
+
+		for (std::size_t j = i + 1; j < layers.size(); ++j) {
+			auto layer = layers[i];
+			merkle_raise_layer(layer, pad_level
+				, merkle_depth(std::size_t(piece_sizes[j] / merkle_block_size)));
+			TEST_CHECK(layer == layers[j]);
+		}
+	}
+
+	// raising a layer past the size of the file leaves the root
+	auto layer = layers.front();
+	merkle_raise_layer(layer, 0, 10);
+	TEST_CHECK(layer.size() == 1 && layer.front() == root);
+}
+
+}
+
+int main()
+{
+	test_proof();
+	test_libtorrent_layers();
+	if (failures > 0) {
+		std::cerr << failures << " checks failed\n";
+		return 1;
+	}
+	std::cout << "all tests passed\n";
+	return 0;
+}
@@ -0,0 +1,303 @@
+/*
+
+Copyright (c) 2026, Arvid Norberg
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#include <cstdio> // for snprintf
+#include <iostream>
+#include <string_view>
+#include <thread>
+#include <mutex>
+#include <map>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <system_error>
+
+#include "libtorrent/torrent_info.hpp"
+#include "libtorrent/span.hpp"
+
+#include "common.hpp"
+#include "hash_files.hpp"
+#include "sidecar.hpp"
+
+using namespace std::string_view_literals;
+
+namespace {
+
+int const default_num_threads
+	= std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+void print_usage()
+{
+	std::cout << R"(USAGE: torrent-verify [OPTIONS] torrent-file
+OPTIONS:
+-d, --data-dir <dir>      The directory the torrent's files are stored in (i.e.
+                          the save path). Defaults to the current directory.
+--threads <n>             Use <n> threads to hash files. Defaults to )"
+	<< default_num_threads << R"(.
+--fail-fast               Stop verifying a file at its first bad piece
+--v1                      Also verify the v1 piece hashes of hybrid torrents
+--use-sidecars            Take the piece layers from the torrent's sidecar
+                          (<torrent-file>.sidecar, see torrent-new --sidecar)
+                          instead of parsing them from the torrent. They are
+                          still checked against the file roots
+-h, --help                Show this message
+
+PARSE OPTIONS:
+--items-limit <count>     Set the upper limit of the number of bencode items
+                          in the torrent file.
+--depth-limit <count>     Set the recursion limit in the bdecoder
+--max-pieces <count>      Set the upper limit on the number of pieces to
+                          load in the torrent.
+--max-size <size>         Reject files larger than this size limit, specified
+                          in MB
+
+Verifies the files of the torrent against its hashes. For v2 torrents, each
+file is verified independently against its piece layer. All files are hashed
+concurrently, large files are also split up to be hashed by multiple threads.
+v1-only torrents are verified by their piece hashes, which may span files.
+
+The result is printed as JSON, listing the files that are missing, have the
+wrong size or have bad pieces. Piece indices of files are relative to the start
+of the file, v1 piece indices are relative to the start of the torrent.
+
+The exit code is 0 if all files are OK, 2 if any of them is not and 1 on
+errors.
+)";
+}
+
+void print_json_string(std::string_view const str)
+{
+	std::cout << '"';
+	for (char const c : str) {
+		switch (c) {
+			case '"': std::cout << "\\\""; break;
+			case '\\': std::cout << "\\\\"; break;
+			case '\n': std::cout << "\\n"; break;
+			case '\r': std::cout << "\\r"; break;
+			case '\t': std::cout << "\\t"; break;
+			default:
+				if (static_cast<unsigned char>(c) < 0x20) {
+					char buf[8];
+					std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+					std::cout << buf;
+				}
+				else {
+					std::cout << c;
+				}
+		}
+	}
+	std::cout << '"';
+}
+
+template <typename T>
+void print_json_list(std::vector<T> const& l)
+{
+	std::cout << '[';
+	for (std::size_t i = 0; i < l.size(); ++i) {
+		if (i > 0) std::cout << ", ";
+		std::cout << static_cast<int>(l[i]);
+	}
+	std::cout << ']';
+}
+
+struct bad_file
+{
+	std::string error;
+	// bad pieces, relative to the start of the file
+	std::vector<int> pieces;
+};
+
+}
+
+int main(int argc, char const* argv[]) try
+{
+	lt::span<char const*> args(argv, argc);
+	// strip executable name
+	args = args.subspan(1);
+
+	lt::load_torrent_limits cfg;
+	std::string data_dir = ".";
+	int num_threads = default_num_threads;
+	bool fail_fast = false;
+	bool verify_v1 = false;
+	bool use_sidecars = false;
+
+	if (args.empty()) {
+		print_usage();
+		return 1;
+	}
+
+	while (!args.empty() && args[0][0] == '-') {
+		if ((args[0] == "-d"sv || args[0] == "--data-dir"sv) && args.size() > 1) {
+			data_dir = args[1];
+			args = args.subspan(1);
+		}
+		else if (args[0] == "--threads"sv && args.size() > 1) {
+			num_threads = atoi(args[1]);
+			args = args.subspan(1);
+		}
+		else if (args[0] == "--fail-fast"sv) {
+			fail_fast = true;
+		}
+		else if (args[0] == "--v1"sv) {
+			verify_v1 = true;
+		}
+		else if (args[0] == "--use-sidecars"sv) {
+			use_sidecars = true;
+		}
+		else if (parse_load_limit(args, cfg)) {
+		}
+		else if (args[0] == "-h"sv || args[0] == "--help"sv) {
+			print_usage();
+			return 0;
+		}
+		else {
+			std::cerr << "unknown option " << args[0] << '\n';
+			print_usage();
+			return 1;
+		}
+		args = args.subspan(1);
+	}
+
+	if (args.size() != 1) {
+		print_usage();
+		return 1;
+	}
+
+	lt::torrent_info const t = use_sidecars
+		? load_torrent_without_layers(args[0], cfg)
+		: lt::torrent_info(args[0], cfg);
+	std::unique_ptr<sidecar const> side;
+	if (use_sidecars) {
+		side = std::make_unique<sidecar const>(std::string(args[0]) + ".sidecar");
+		side->check(t);
+		side->check_layers(t);
+	}
+	lt::file_storage const& fs = t.files();
+	bool const has_v2 = t.info_hashes().has_v2();
+	verify_v1 = t.info_hashes().has_v1() && (verify_v1 || !has_v2);
+
+	std::map<lt::file_index_t, bad_file> bad_files;
+	std::mutex mutex;
+
+	// files that are missing, or have the wrong size, are not hashed
+	std::vector<file_hashes> files;
+	std::vector<lt::file_index_t> file_index;
+	int num_files = 0;
+	for (auto const f : fs.file_range()) {
+		if (fs.pad_file_at(f)) continue;
+		++num_files;
+		std::error_code ec;
+		std::string const path = fs.file_path(f, data_dir);
+		auto const size = std::filesystem::file_size(path, ec);
+		if (ec) {
+			bad_files[f].error = "missing";
+			continue;
+		}
+		if (std::int64_t(size) != fs.file_size(f)) {
+			bad_files[f].error = "size mismatch";
+			continue;
+		}
+		if (size == 0) continue;
+		auto& h = files.emplace_back();
+		h.path = path;
+		h.size = std::int64_t(size);
+		file_index.push_back(f);
+	}
+
+	if (has_v2) {
+		hash_files(files, t.piece_length(), num_threads, nullptr
+			, [&](std::size_t const i, int const piece, lt::sha256_hash const& h) {
+				lt::file_index_t const f = file_index[i];
+				// piece_layer() returns the root for files with a single piece
+				auto const layer = side ? side->piece_layer(f) : t.piece_layer(f);
+				std::ptrdiff_t const hash_size = std::ptrdiff_t(lt::sha256_hash::size());
+				std::ptrdiff_t const offset = std::ptrdiff_t(piece) * hash_size;
+				if (offset + hash_size > layer.size()) {
+					// there's nothing to verify the file against
+					std::lock_guard<std::mutex> l(mutex);
+					bad_files[f].error = "missing piece layer";
+					return false;
+				}
+				if (h == lt::sha256_hash(layer.data() + offset)) return true;
+				std::lock_guard<std::mutex> l(mutex);
+				auto& b = bad_files[f];
+				b.error = "hash mismatch";
+				b.pieces.push_back(piece);
+				return !fail_fast;
+			});
+	}
+
+	std::vector<lt::piece_index_t> bad_v1_pieces;
+	if (verify_v1) {
+		// pieces overlapping files we know are bad cannot be read
+		std::vector<lt::piece_index_t> pieces;
+		for (auto const p : fs.piece_range()) {
+			bool readable = true;
+			for (auto const& s : fs.map_block(p, 0, fs.piece_size(p))) {
+				auto const it = bad_files.find(s.file_index);
+				if (it != bad_files.end() && (it->second.error == "missing"
+					|| it->second.error == "size mismatch")) {
+					readable = false;
+					break;
+				}
+			}
+			if (readable) pieces.push_back(p);
+			else bad_v1_pieces.push_back(p);
+		}
+
+		hash_v1_pieces(fs, data_dir, pieces, num_threads
+			, [&](lt::piece_index_t const p, lt::sha1_hash const& h) {
+				if (h == t.hash_for_piece(p)) return;
+				std::lock_guard<std::mutex> l(mutex);
+				bad_v1_pieces.push_back(p);
+				for (auto const& s : fs.map_block(p, 0, fs.piece_size(p))) {
+					if (fs.pad_file_at(s.file_index)) continue;
+					auto& b = bad_files[s.file_index];
+					if (b.error.empty()) b.error = "hash mismatch";
+				}
+			});
+		std::sort(bad_v1_pieces.begin(), bad_v1_pieces.end());
+	}
+
+	std::cout << "{\n  \"torrent\": ";
+	print_json_string(args[0]);
+	std::cout << ",\n  \"files\": " << num_files
+		<< ",\n  \"ok\": " << (bad_files.empty() ? "true" : "false")
+		<< ",\n  \"bad-files\": [";
+	bool first = true;
+	for (auto& [f, b] : bad_files) {
+		std::sort(b.pieces.begin(), b.pieces.end());
+		std::cout << (first ? "\n" : ",\n") << "    {\"index\": " << static_cast<int>(f)
+			<< ", \"path\": ";
+		print_json_string(fs.file_path(f));
+		std::cout << ", \"error\": ";
+		print_json_string(b.error);
+		if (!b.pieces.empty()) {
+			std::cout << ", \"bad-pieces\": ";
+			print_json_list(b.pieces);
+		}
+		std::cout << '}';
+		first = false;
+	}
+	std::cout << (first ? "]" : "\n  ]");
+	if (verify_v1) {
+		std::cout << ",\n  \"bad-v1-pieces\": ";
+		print_json_list(bad_v1_pieces);
+	}
+	std::cout << "\n}\n";
+
+	return bad_files.empty() ? 0 : 2;
+}
+catch (std::exception const& e)
+{
+	std::cerr << "failed: " << e.what() << '\n';
+	return 1;
+}